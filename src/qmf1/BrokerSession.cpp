@@ -0,0 +1,440 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Defines the BrokerSession class.
+ */
+
+#include "BrokerSession.h"
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+
+#include <boost/functional/hash.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <algorithm>
+#include <sstream>
+
+#include <unistd.h>
+
+namespace {
+
+/// Maximum seconds stop waits for the session thread (eg blocked in addBroker).
+const unsigned int maxStopWait = 5;
+
+}
+
+/**
+ * @brief Constructor.
+ *
+ * @param connectionSettings Settings for connecting to the broker.
+ */
+BrokerSession::BrokerSession(const qpid::client::ConnectionSettings &connectionSettings)
+    : connectionSettings(connectionSettings), refreshRequests(0),
+      refreshesCompleted(0), refreshStopped(false), initialReconnectDelay(1),
+      maxReconnectDelay(60)
+{
+    std::ostringstream stream;
+    stream << connectionSettings.host << ':' << connectionSettings.port;
+    name = stream.str();
+
+    // Seed per process and broker, so PMDAs on different hosts (and sessions
+    // within this PMDA) choose different reconnect delays.
+    random.seed(static_cast<uint32_t>(time(NULL) ^ getpid() ^ boost::hash<std::string>()(name)));
+}
+
+/**
+ * @brief Destructor.
+ *
+ * Sessions whose stop function returned \c false must not be destroyed, since
+ * their session thread may still be using them.
+ */
+BrokerSession::~BrokerSession()
+{
+    stop();
+}
+
+/**
+ * @brief Get this session's broker name.
+ *
+ * @return The broker's name, as "host:port".
+ */
+const std::string &BrokerSession::getName() const
+{
+    return name;
+}
+
+/**
+ * @brief Get this session's QMF console listener.
+ *
+ * The listener should be fully configured before start is called.
+ *
+ * @return This session's listener.
+ */
+ConsoleListener &BrokerSession::getListener()
+{
+    return listener;
+}
+
+/**
+ * @brief Get this session's QMF console listener.
+ *
+ * @return This session's listener.
+ */
+const ConsoleListener &BrokerSession::getListener() const
+{
+    return listener;
+}
+
+/**
+ * @brief Start this session.
+ *
+ * This starts the listener's update threads, binds the QMF session to just
+ * the given classes (see QpidPmdaQmf1::getSessionSettings), and then starts
+ * the session and refresh threads. The session thread connects to the broker
+ * in the background, so this function returns without waiting for the broker
+ * to connect.
+ *
+ * @param settings   QMF session settings.
+ * @param classNames Names of the QMF classes to bind to, and query.
+ */
+void BrokerSession::start(const qpid::console::SessionManager::Settings &settings,
+                          const std::vector<std::string> &classNames)
+{
+    this->classNames = classNames;
+    classTypes.clear();
+    for (std::vector<std::string>::const_iterator className = classNames.begin();
+         className != classNames.end(); ++className)
+    {
+        int type = 0;
+        while ((type < ConsoleUtils::Other) &&
+               (ConsoleUtils::getClassName(static_cast<ConsoleUtils::ObjectSchemaType>(type)) != *className)) {
+            ++type;
+        }
+        classTypes.push_back(static_cast<ConsoleUtils::ObjectSchemaType>(type));
+    }
+    lastRefreshTimes.assign(classNames.size(), 0);
+    listener.start();
+
+    sessionManager.reset(new qpid::console::SessionManager(&listener, settings));
+    for (std::vector<std::string>::const_iterator className = classNames.begin();
+         className != classNames.end(); ++className)
+    {
+        if (pmDebug & DBG_TRACE_APPL0) {
+            __pmNotifyErr(LOG_DEBUG, "%s binding %s to %s", __FUNCTION__,
+                          name.c_str(), className->c_str());
+        }
+        sessionManager->bindClass("org.apache.qpid.broker", *className);
+    }
+    sessionThread = boost::thread(&BrokerSession::run, this);
+    refreshThread = boost::thread(&BrokerSession::refreshRequested, this);
+}
+
+/**
+ * @brief Stop this session's threads.
+ *
+ * The session thread is interrupted, which wakes any connect or reconnect
+ * delay. However, QMF's addBroker cannot be interrupted, so if the session
+ * thread is still blocked there after a few seconds, it is detached instead,
+ * and will exit as soon as addBroker returns.
+ *
+ * The QMF session itself is closed when this session is destroyed.
+ *
+ * @return \c true if all threads stopped, else \c false if the session thread
+ *         was detached, in which case this session must not be destroyed.
+ */
+bool BrokerSession::stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(refreshMutex);
+        refreshStopped = true;
+    }
+    refreshCondition.notify_all();
+    if (refreshThread.joinable()) {
+        refreshThread.join(); // Any query in progress is bounded by getTimeout.
+    }
+    listener.stop();
+    if (sessionThread.joinable()) {
+        sessionThread.interrupt(); // Wake any connect or reconnect delay.
+        if (!sessionThread.timed_join(boost::posix_time::seconds(maxStopWait))) {
+            __pmNotifyErr(LOG_WARNING, "gave up waiting for broker %s to connect",
+                          name.c_str());
+            sessionThread.detach();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Request a refresh of this session's QMF objects, if its data is too old.
+ *
+ * Each of the session's QMF classes is refreshed if no QMF updates have been
+ * applied for objects of that class (nor has it been requested by this
+ * function) within \a maxStaleness seconds. So we don't retry any sooner than
+ * that either, in case the broker has nothing to report.
+ *
+ * Note, QMFv1's getObjects can only select objects by class, package, broker
+ * or agent, not by object ID, so querying just the stale classes is the
+ * narrowest refresh available.
+ *
+ * The refresh itself is performed by the refresh thread, so this function
+ * never blocks on the broker; use waitForRefresh to wait for it to complete.
+ * Brokers not (yet) connected are never queried. This should only be called
+ * by the PMDA's own thread.
+ *
+ * @param maxStaleness Maximum age, in seconds, of the broker's data.
+ *
+ * @return \c true if a refresh was requested, else \c false.
+ *
+ * @see refreshRequested
+ */
+bool BrokerSession::requestRefresh(const time_t maxStaleness)
+{
+    if (!listener.isConnected()) {
+        return false;
+    }
+    const time_t now = time(NULL);
+    std::vector<std::string> staleClasses;
+    for (size_t index = 0; index < classNames.size(); ++index) {
+        if (now - std::max(listener.getLastUpdateTime(classTypes[index]),
+                           lastRefreshTimes[index]) >= maxStaleness) {
+            lastRefreshTimes[index] = now;
+            staleClasses.push_back(classNames[index]);
+        }
+    }
+    if (staleClasses.empty()) {
+        return false;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(refreshMutex);
+        pendingClasses.insert(staleClasses.begin(), staleClasses.end());
+        ++refreshRequests;
+    }
+    refreshCondition.notify_all();
+    return true;
+}
+
+/**
+ * @brief Wait for all requested refreshes to complete.
+ *
+ * @param deadline Time to give up waiting.
+ *
+ * @return \c true if all requested refreshes completed, else \c false if the
+ *         deadline passed, or the session was stopped, first.
+ *
+ * @see requestRefresh
+ */
+bool BrokerSession::waitForRefresh(const boost::system_time &deadline)
+{
+    boost::unique_lock<boost::mutex> lock(refreshMutex);
+    while ((refreshesCompleted < refreshRequests) && (!refreshStopped)) {
+        if (!refreshCondition.timed_wait(lock, deadline)) {
+            break;
+        }
+    }
+    return (refreshesCompleted >= refreshRequests);
+}
+
+/**
+ * @brief Refresh some of this session's QMF objects, by querying the broker.
+ *
+ * This issues a synchronous getObjects query per QMF class (limited by the
+ * session's getTimeout setting), and applies the results via the listener's
+ * update threads, waiting for them to be applied.
+ *
+ * Queries are serialized per session, since both the session thread (priming
+ * newly connected brokers) and the refresh thread (refreshing stale data) may
+ * call this function, and QMF's getObjects is not safe to call concurrently on
+ * the same session manager.
+ *
+ * @param classNames Names of the QMF classes to query.
+ *
+ * @see primeObjects
+ * @see refreshRequested
+ */
+void BrokerSession::refreshObjects(const std::vector<std::string> &classNames)
+{
+    if (!sessionManager) {
+        return; // Not started.
+    }
+    boost::unique_lock<boost::mutex> lock(queryMutex);
+    for (std::vector<std::string>::const_iterator className = classNames.begin();
+         className != classNames.end(); ++className)
+    {
+        qpid::console::Object::Vector objects;
+        try {
+            sessionManager->getObjects(objects, *className, "org.apache.qpid.broker");
+        } catch (const qpid::Exception &ex) {
+            __pmNotifyErr(LOG_WARNING, "failed to query %s objects from %s: %s",
+                          className->c_str(), name.c_str(), ex.what());
+            continue;
+        }
+        if (pmDebug & DBG_TRACE_APPL0) {
+            __pmNotifyErr(LOG_DEBUG, "%s received %ju %s objects from %s", __FUNCTION__,
+                          (uintmax_t)objects.size(), className->c_str(), name.c_str());
+        }
+        listener.applyObjects(objects);
+    }
+}
+
+/**
+ * @brief Refresh requested classes, until stopped.
+ *
+ * This is the body of the refresh thread. Classes requested while a refresh
+ * is in progress are refreshed together, once it completes.
+ *
+ * @see requestRefresh
+ * @see waitForRefresh
+ */
+void BrokerSession::refreshRequested()
+{
+    boost::unique_lock<boost::mutex> lock(refreshMutex);
+    while (!refreshStopped) {
+        if (pendingClasses.empty()) {
+            refreshCondition.wait(lock);
+            continue;
+        }
+        const std::vector<std::string> classes(pendingClasses.begin(), pendingClasses.end());
+        const uint64_t requests = refreshRequests;
+        pendingClasses.clear();
+        lock.unlock();
+        refreshObjects(classes);
+        lock.lock();
+        refreshesCompleted = requests;
+        refreshCondition.notify_all();
+    }
+}
+
+/**
+ * @brief Set the backoff limits for re-priming reconnected brokers.
+ *
+ * After each reconnect, the broker is re-primed after a random delay of up to
+ * \a initial seconds, doubling for each consecutive reconnect, up to \a max
+ * seconds. A connection that stays up for at least \a max seconds resets the
+ * backoff.
+ *
+ * @param initial Initial backoff, in seconds.
+ * @param max     Maximum backoff, in seconds.
+ */
+void BrokerSession::setReconnectDelays(const unsigned int initial, const unsigned int max)
+{
+    initialReconnectDelay = initial;
+    maxReconnectDelay = std::max(initial, max);
+}
+
+/**
+ * @brief Add the broker to the QMF session.
+ *
+ * This may block for some time (eg on TCP connect, SASL and QMF schema
+ * negotiation), which is why it is only ever called by the session thread.
+ *
+ * @return \c true if the broker was added, else \c false.
+ */
+bool BrokerSession::connect()
+{
+    __pmNotifyErr(LOG_INFO, "connecting to broker %s", name.c_str());
+    try {
+        // Local variable needed because addBroker takes a non-const argument.
+        qpid::client::ConnectionSettings settings(connectionSettings);
+        sessionManager->addBroker(settings);
+    } catch (const qpid::Exception &ex) {
+        __pmNotifyErr(LOG_ERR, "failed to add broker %s: %s", name.c_str(), ex.what());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Wait a random, exponentially backed off, delay before re-priming.
+ *
+ * This uses "full jitter", ie a delay chosen uniformly between zero and the
+ * current backoff, which spreads reconnecting PMDAs' queries most evenly.
+ *
+ * @param reconnects Number of consecutive reconnects (or connect attempts),
+ *                   including this one.
+ * @param action     What is being delayed, for logging.
+ *
+ * @throw boost::thread_interrupted if stop is called while waiting.
+ */
+void BrokerSession::delayReconnect(const unsigned int reconnects, const char * const action)
+{
+    uint64_t backoff = initialReconnectDelay;
+    for (unsigned int count = 1; (count < reconnects) && (backoff < maxReconnectDelay); ++count) {
+        backoff *= 2;
+    }
+    backoff = std::min<uint64_t>(backoff, maxReconnectDelay) * 1000;
+
+    const uint64_t delay = boost::random::uniform_int_distribution<uint64_t>(0, backoff)(random);
+    __pmNotifyErr(LOG_INFO, "%s broker %s in %jums (attempt %u)",
+                  action, name.c_str(), (uintmax_t)delay, reconnects);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(delay));
+}
+
+/**
+ * @brief Prime the broker's objects each time it connects, until stopped.
+ *
+ * As soon as the broker connects, this queries all of the broker's objects, so
+ * that the PMDA does not have to wait for the broker's next periodic publish
+ * (up to mgmtPubInterval) to discover them. The results are applied in a
+ * single batch, so the next fetch registers all of them together.
+ *
+ * On reconnects, the broker's old objects are retired first, and re-priming is
+ * delayed (see delayReconnect). The retired objects are only released once
+ * re-priming is complete, so that live objects take over their namesakes' PCP
+ * instances first, keeping instance IDs stable across broker restarts.
+ *
+ * @see ConsoleListener::takeConnectedBroker
+ * @see ConsoleListener::retireObjects
+ */
+void BrokerSession::primeObjects()
+{
+    std::string url;
+    time_t lastConnectTime = 0;
+    unsigned int reconnects = 0;
+    while (listener.takeConnectedBroker(url)) {
+        const time_t now = time(NULL);
+        if (lastConnectTime != 0) {
+            reconnects = (now - lastConnectTime < static_cast<time_t>(maxReconnectDelay))
+                ? reconnects + 1 : 1;
+            listener.retireObjects();
+            delayReconnect(reconnects, "re-priming");
+        }
+        lastConnectTime = now;
+        __pmNotifyErr(LOG_INFO, "priming objects from broker %s", url.c_str());
+        refreshObjects(classNames);
+        listener.releaseRetiredObjects();
+    }
+}
+
+/**
+ * @brief Connect to, then prime, the broker, until stopped.
+ *
+ * This is the body of the session thread. Failed connects are retried after
+ * the same backoff as reconnects (see delayReconnect).
+ *
+ * @see connect
+ * @see primeObjects
+ */
+void BrokerSession::run()
+{
+    for (unsigned int attempts = 1; !connect(); ++attempts) {
+        delayReconnect(attempts, "reconnecting to");
+    }
+    primeObjects();
+}
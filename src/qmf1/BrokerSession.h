@@ -0,0 +1,124 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Declares the BrokerSession class.
+ */
+
+#ifndef __QPID_PMDA_BROKER_SESSION_H__
+#define __QPID_PMDA_BROKER_SESSION_H__
+
+#include "ConsoleListener.h"
+
+#include <qpid/client/ConnectionSettings.h>
+#include <qpid/console/SessionManager.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief An independent QMF session with a single broker.
+ *
+ * Each broker monitored by the PMDA gets its own QMF session manager, console
+ * listener (and so object store, update threads and locks), and session thread.
+ * So one overloaded or unreachable broker can only ever delay its own updates,
+ * never those of the other brokers.
+ *
+ * The broker is connected to by the session thread, so start never blocks on
+ * TCP connects, SASL or schema negotiation, and all brokers connect in
+ * parallel.
+ *
+ * When the broker reconnects (eg after a restart), the session thread waits a
+ * random delay, capped by an exponential backoff, before re-priming the
+ * broker's objects, so that many PMDAs reconnecting to the same broker do not
+ * all query its management agent at once. The broker's old objects are then
+ * retired in a single pass (see ConsoleListener::retireObjects).
+ *
+ * Stale data is refreshed on demand by a separate refresh thread (see
+ * requestRefresh), so the PMDA can query all brokers in parallel, and never
+ * blocks on any one of them for longer than it chooses to wait.
+ */
+class BrokerSession {
+
+public:
+    explicit BrokerSession(const qpid::client::ConnectionSettings &connectionSettings);
+
+    ~BrokerSession();
+
+    const std::string &getName() const;
+
+    ConsoleListener &getListener();
+
+    const ConsoleListener &getListener() const;
+
+    void start(const qpid::console::SessionManager::Settings &settings,
+               const std::vector<std::string> &classNames);
+
+    bool stop();
+
+    bool requestRefresh(const time_t maxStaleness);
+
+    bool waitForRefresh(const boost::system_time &deadline);
+
+    void setReconnectDelays(const unsigned int initial, const unsigned int max);
+
+protected:
+    qpid::client::ConnectionSettings connectionSettings; ///< Broker to connect to.
+    std::string name;                     ///< Broker name, as "host:port".
+    std::vector<std::string> classNames;  ///< QMF classes to bind and query.
+
+    ConsoleListener listener; ///< QMF console listener for this broker only.
+    boost::scoped_ptr<qpid::console::SessionManager> sessionManager; ///< QMF session manager.
+    boost::thread sessionThread; ///< Thread connecting to, and priming, the broker.
+    boost::mutex queryMutex; ///< Serializes getObjects queries (see refreshObjects).
+
+    std::vector<ConsoleUtils::ObjectSchemaType> classTypes; ///< Object types, by classNames index.
+    std::vector<time_t> lastRefreshTimes; ///< Times requestRefresh last requested, by class.
+    boost::thread refreshThread; ///< Thread refreshing stale classes (see requestRefresh).
+    std::set<std::string> pendingClasses; ///< Classes requested, but not yet being refreshed.
+    uint64_t refreshRequests;    ///< Number of refreshes requested so far.
+    uint64_t refreshesCompleted; ///< Number of refresh requests completed so far.
+    bool refreshStopped;         ///< Has stop been called?
+    boost::mutex refreshMutex;   ///< Protects the above.
+    boost::condition_variable refreshCondition; ///< Signalled on request, completion and stop.
+
+    unsigned int initialReconnectDelay; ///< Initial reconnect backoff, in seconds.
+    unsigned int maxReconnectDelay;     ///< Maximum reconnect backoff, in seconds.
+    boost::random::mt19937 random;      ///< Reconnect jitter source (session thread only).
+
+    bool connect();
+
+    void delayReconnect(const unsigned int reconnects, const char * const action);
+
+    void primeObjects();
+
+    void refreshObjects(const std::vector<std::string> &classNames);
+
+    void refreshRequested();
+
+    void run();
+
+};
+
+#endif
@@ -25,79 +25,127 @@
 
 #include <qpid/console/Value.h>
 
+#include <boost/bind/bind.hpp>
+
+#include <algorithm>
+
 #include <pcp/pmapi.h>
 #include <pcp/impl.h>
 
 /**
  * @brief Default constructor.
  */
-ConsoleListener::ConsoleListener() : includeAutoDelete(false)
+ConsoleListener::ConsoleListener()
+    : includeAutoDelete(false), deleteGracePeriod(60), maxPendingUpdates(65536),
+      updateThreadCount(1), generation(0), lastUpdateTime(0), maxEvictedObjects(65536),
+      evictedCount(0),
+      stopped(false), connectedCount(0), connectCount(0)
 {
+    for (int type = 0; type < ConsoleUtils::Other; ++type) {
+        lastUpdateTimes[type] = 0;
+        objectCounts[type] = 0;
+        maxObjects[type] = 0;
+    }
+}
 
+/**
+ * @brief Destructor.
+ */
+ConsoleListener::~ConsoleListener()
+{
+    stop();
 }
 
 /**
- * @brief Get the next new QMF object ID, if any.
+ * @brief Start the update threads.
  *
- * The ConsoleListener class maintains a list of new object IDs - that is, ones
- * that have not been seen before.  This function can then be used to consume
- * those object IDs one at a time.
+ * Until this is called, QMF updates are ignored. This should be called after
+ * all layouts have been set (see setLayout), but before any brokers are added
+ * to the QMF session.
  *
- * This allow the owning PMDA instance to check for the arrival of new QMF
- * object, and register them with PCP accordingly.
- *
- * @return A QMF object ID, or an unset boost::optional if no new IDs are
- *         available.
+ * @see setUpdateThreads
+ */
+void ConsoleListener::start()
+{
+    if (!updates.empty()) {
+        return; // Already started.
+    }
+    const size_t capacity = std::max<size_t>(maxPendingUpdates / updateThreadCount, 1);
+    for (size_t count = 0; count < updateThreadCount; ++count) {
+        const boost::shared_ptr<UpdateBuffer> buffer(new UpdateBuffer(capacity));
+        updates.push_back(buffer);
+        updateThreads.create_thread(boost::bind(&ConsoleListener::applyUpdates, this, buffer));
+    }
+}
+
+/**
+ * @brief Stop the update threads.
  *
- * @see QpidPmdaQmf1::begin_fetch_values
+ * Any updates still pending are discarded, and any takeConnectedBroker calls
+ * are woken.
  */
-boost::optional<qpid::console::ObjectId> ConsoleListener::getNewObjectId()
+void ConsoleListener::stop()
 {
-    boost::optional<qpid::console::ObjectId> id;
-    boost::unique_lock<boost::mutex> lock(newObjectsMutex);
-    if (!newObjects.empty()) {
-        id = newObjects.front();
-        newObjects.pop();
+    {
+        boost::unique_lock<boost::mutex> lock(connectedBrokersMutex);
+        stopped = true;
     }
-    return id;
+    connectedBrokersCondition.notify_all();
+
+    for (std::vector<boost::shared_ptr<UpdateBuffer> >::const_iterator iter = updates.begin();
+         iter != updates.end(); ++iter)
+    {
+        (*iter)->stop();
+    }
+    updateThreads.join_all();
 }
 
 /**
- * @brief Get a QMF properties object for a QMF object ID.
+ * @brief Take all new QMF objects, if any.
+ *
+ * The ConsoleListener class maintains a list of new objects - that is, ones
+ * that have not been seen before.  This function consumes all of those objects
+ * at once, in the order they arrived, swapping them out under a single lock,
+ * so that the update threads are not held up while the caller registers them.
+ *
+ * This allow the owning PMDA instance to check for the arrival of new QMF
+ * object, and register them with PCP accordingly.
  *
- * @param id QMF object ID to fecth properties for.
+ * @param entries Vector to append the new objects' entries to.
  *
- * @return A QMF properties object, or an unset boost::optional if the requested
- *         object ID could not be found in the known properties map.
+ * @return The number of new objects appended to \a entries.
+ *
+ * @see QpidPmdaQmf1::begin_fetch_values
  */
-boost::optional<qpid::console::Object> ConsoleListener::getProps(const qpid::console::ObjectId &id)
+size_t ConsoleListener::takeNewObjects(std::vector<ObjectEntry::Ptr> &entries)
 {
-    boost::optional<qpid::console::Object> object;
-    boost::unique_lock<boost::mutex> lock(propsMutex);
-    const ObjectMap::const_iterator iter = props.find(id);
-    if (iter != props.end()) {
-        object = iter->second;
+    std::vector<ObjectEntry::Ptr> taken;
+    {
+        boost::unique_lock<boost::mutex> lock(newObjectsMutex);
+        taken.swap(newObjects);
+    }
+    if (entries.empty()) {
+        entries.swap(taken);
+        return entries.size();
     }
-    return object;
+    entries.insert(entries.end(), taken.begin(), taken.end());
+    return taken.size();
 }
 
 /**
- * @brief Get a QMF statistics object for a QMF object ID.
+ * @brief Set the prefix for all decoded objects' names.
+ *
+ * When monitoring several brokers, the PMDA sets a prefix identifying each
+ * broker, so that the broker's objects' names (and so PCP instance names) do
+ * not collide with those of the same name on other brokers.
  *
- * @param id QMF object ID to fecth statistics for.
+ * This should be called before start.
  *
- * @return A QMF statistics object, or an unset boost::optional if the requested
- *         object ID could not be found in the known statisitics map.
+ * @param prefix Prefix for all decoded objects' properties' names.
  */
-boost::optional<qpid::console::Object> ConsoleListener::getStats(const qpid::console::ObjectId &id)
+void ConsoleListener::setNamePrefix(const std::string &prefix)
 {
-    boost::optional<qpid::console::Object> object;
-    boost::unique_lock<boost::mutex> lock(statsMutex);
-    const ObjectMap::const_iterator iter = stats.find(id);
-    if (iter != stats.end()) {
-        object = iter->second;
-    }
-    return object;
+    namePrefix = prefix;
 }
 
 /**
@@ -115,11 +163,10 @@ boost::optional<qpid::console::Object> ConsoleListener::getStats(const qpid::con
  * tracked (the QpidPmdaQmf1 class exposes this via the --include-auto-delete
  * command line option).
  *
- * @note Issue #4: Currently this class does not purge old stale QMF objects.
- *       This would rarely be an issue when includeAutoDelete is \c false,
- *       however, you should exercise even greater caution setting
- *       includeAutoDelete to \c true as long as that issues has not been
- *       resolved yet. See https://github.com/pcolby/pcp-pmda-qpid/issues/4
+ * @note Objects deleted by the broker are purged once their grace period has
+ *       expired (see setDeleteGracePeriod), but with includeAutoDelete set to
+ *       \c true, the number of objects tracked at any one time can still be
+ *       very large on busy brokers.
  *
  * @param include Whether or not to include auto-delete objects.
  */
@@ -128,17 +175,537 @@ void ConsoleListener::setIncludeAutoDelete(const bool include)
     includeAutoDelete = include;
 }
 
+/**
+ * @brief Set which queues to track, by name.
+ *
+ * Each queue is checked against these filters once, when first seen. Queues
+ * rejected then are remembered (by object ID only) until the broker deletes
+ * them, so that all of their subsequent updates are discarded as they arrive,
+ * without further filtering, buffering, nor decoding.
+ *
+ * @param include Globs of queue names to include, or empty to include all.
+ * @param exclude Globs of queue names to exclude, even if included.
+ *
+ * @see isIncluded
+ */
+void ConsoleListener::setQueueFilters(const std::vector<std::string> &include,
+                                      const std::vector<std::string> &exclude)
+{
+    queueIncludes = include;
+    queueExcludes = exclude;
+}
+
+/**
+ * @brief Get the number of objects currently rejected.
+ *
+ * @return The number of rejected objects not yet deleted by the broker.
+ *
+ * @see setQueueFilters
+ */
+size_t ConsoleListener::getRejectedCount() const
+{
+    boost::unique_lock<boost::mutex> lock(rejectedObjectsMutex);
+    return rejectedObjects.size();
+}
+
+/**
+ * @brief Set how long to keep objects after the broker has deleted them.
+ *
+ * When the broker deletes an object, its final properties and statistics are
+ * kept (and so reported by the PMDA) for this grace period, so that clients
+ * sampling slower than the broker publishes may still see the final values.
+ *
+ * @param seconds Grace period, in seconds.
+ *
+ * @see takeExpiredObjects
+ */
+void ConsoleListener::setDeleteGracePeriod(const time_t seconds)
+{
+    deleteGracePeriod = seconds;
+}
+
+/**
+ * @brief Take all deleted objects whose grace period has expired.
+ *
+ * Expired objects are removed from this listener, so this function will only
+ * ever report each expired object once. The caller should release its own
+ * references to the returned objects, so their memory can be reclaimed.
+ *
+ * Objects evicted due to object limits (see setMaxObjects) are reported here
+ * too, since the caller must drop them in just the same way.
+ *
+ * @param expired Vector to append the expired objects to.
+ *
+ * @return The number of expired objects appended to \a expired.
+ *
+ * @see QpidPmdaQmf1::begin_fetch_values
+ */
+size_t ConsoleListener::takeExpiredObjects(std::vector<ObjectEntry::Ptr> &expired)
+{
+    const size_t initialSize = expired.size();
+    const time_t cutoff = time(NULL) - deleteGracePeriod;
+    {
+        boost::unique_lock<boost::mutex> lock(deletedObjectsMutex);
+        while ((!deletedObjects.empty()) && (deletedObjects.front().first <= cutoff)) {
+            expired.push_back(deletedObjects.front().second);
+            deletedObjects.pop_front();
+        }
+    }
+    const size_t deletedSize = expired.size();
+    if (deletedSize > initialSize) {
+        boost::unique_lock<boost::mutex> lock(objectsMutex);
+        for (std::vector<ObjectEntry::Ptr>::const_iterator iter = expired.begin() + initialSize;
+             iter != expired.end(); ++iter)
+        {
+            const ObjectIndex::iterator object = objects.find((*iter)->getObjectId());
+            // Skip entries already retired, and so possibly replaced by a namesake.
+            if ((object != objects.end()) && (object->second.entry == *iter)) {
+                dropStats(object->second.type, (*iter)->getStats());
+                recentObjects[object->second.type].erase(object->second.recent);
+                --objectCounts[object->second.type];
+                objects.erase(object);
+            }
+        }
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(deletedObjectsMutex);
+        expired.insert(expired.end(), droppedObjects.begin(), droppedObjects.end());
+        droppedObjects.clear();
+    }
+    return expired.size() - initialSize;
+}
+
+/**
+ * @brief Retire all currently known objects, in a single pass.
+ *
+ * This is used when a broker reconnects, since its objects are then reported
+ * afresh (typically with new object IDs), so any state kept for the old IDs
+ * would otherwise be leaked. All known objects are removed from this listener
+ * at once, so that subsequent updates create new entries.
+ *
+ * Retired objects keep their PCP instances until releaseRetiredObjects is
+ * called. The caller should do that only once the broker's objects have been
+ * re-primed, so that live objects take over their retired namesakes' instances
+ * (and so instance IDs) before the rest are dropped.
+ *
+ * Synthetic "<other>" objects are not retired, since they are not tied to any
+ * QMF object ID.
+ *
+ * Retired objects' statistics, including their counters, are removed from the
+ * aggregates in full, since the broker will report the same objects again
+ * (with their full counters) as soon as it is re-primed. Only objects the
+ * broker has actually deleted keep their counters in the aggregates (see
+ * dropStats).
+ *
+ * @return The number of objects retired.
+ *
+ * @see releaseRetiredObjects
+ */
+size_t ConsoleListener::retireObjects()
+{
+    size_t count = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(objectsMutex);
+        retiredObjects.reserve(retiredObjects.size() + objects.size());
+        for (ObjectIndex::const_iterator iter = objects.begin(); iter != objects.end(); ++iter) {
+            // Deleted objects are already due to expire after their grace period.
+            if (iter->second.entry->isDeleted()) {
+                dropStats(iter->second.type, iter->second.entry->getStats());
+            } else {
+                countStats(iter->second.type, iter->second.entry->getStats(), true);
+                retiredObjects.push_back(iter->second.entry);
+                ++count;
+            }
+        }
+        objects.clear();
+        for (int type = 0; type < ConsoleUtils::Other; ++type) {
+            recentObjects[type].clear();
+            objectCounts[type] = 0;
+        }
+        // Evicted objects are still ignored, since the broker may report them
+        // again, with the counters already folded into "<other>".
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(rejectedObjectsMutex);
+        rejectedObjects.clear();
+    }
+    __pmNotifyErr(LOG_INFO, "retired %ju objects", (uintmax_t)count);
+    return count;
+}
+
+/**
+ * @brief Release all objects retired by retireObjects.
+ *
+ * Released objects are reported via takeExpiredObjects, so that the PMDA drops
+ * the instances of any that have not been taken over by live objects.
+ *
+ * @see retireObjects
+ */
+void ConsoleListener::releaseRetiredObjects()
+{
+    std::vector<ObjectEntry::Ptr> released;
+    {
+        boost::unique_lock<boost::mutex> lock(objectsMutex);
+        released.swap(retiredObjects);
+    }
+    if (!released.empty()) {
+        boost::unique_lock<boost::mutex> lock(deletedObjectsMutex);
+        droppedObjects.insert(droppedObjects.end(), released.begin(), released.end());
+    }
+}
+
+/**
+ * @brief Set the maximum number of objects of a given type to track.
+ *
+ * Once this limit is reached, each new object evicts the least recently active
+ * object of the same type. An evicted object's counters are folded into a single
+ * synthetic "<other>" object of that type (so counter totals across all objects
+ * remain correct, as of the evictions), and any further updates for the evicted
+ * object are ignored. Its other statistics (eg queue depths) are not folded, as
+ * they would no longer be updated.
+ *
+ * To ignore those updates, evicted objects' IDs are remembered until the broker
+ * deletes them (including across reconnects), up to a separate limit (see
+ * setMaxEvictedObjects).
+ *
+ * @param type QMF object type to limit.
+ * @param max  Maximum number of objects, or \c 0 for no limit.
+ */
+void ConsoleListener::setMaxObjects(const ConsoleUtils::ObjectSchemaType type, const size_t max)
+{
+    if (type < ConsoleUtils::Other) {
+        boost::unique_lock<boost::mutex> lock(objectsMutex);
+        maxObjects[type] = max;
+    }
+}
+
+/**
+ * @brief Set the maximum number of evicted objects' IDs to remember.
+ *
+ * Evicted objects' IDs are remembered until the broker deletes them, so that
+ * their further updates are ignored (see setMaxObjects). This limit keeps that
+ * memory bounded even if the broker never reports the deletes (eg because it
+ * restarted). Beyond it, the oldest evicted IDs are forgotten, and should one
+ * of those objects be updated again, it will be tracked anew, so its counters
+ * will then be counted both in "<other>" and in its own right.
+ *
+ * @param max Maximum number of evicted object IDs to remember.
+ */
+void ConsoleListener::setMaxEvictedObjects(const size_t max)
+{
+    boost::unique_lock<boost::mutex> lock(objectsMutex);
+    maxEvictedObjects = max;
+}
+
+/**
+ * @brief Get the number of objects evicted so far.
+ *
+ * @return The number of objects evicted due to object limits.
+ *
+ * @see setMaxObjects
+ */
+uint64_t ConsoleListener::getEvictedCount() const
+{
+    boost::unique_lock<boost::mutex> lock(objectsMutex);
+    return evictedCount;
+}
+
+/**
+ * @brief Get a histogram of a statistic across all of this listener's objects.
+ *
+ * Like the aggregates, histograms are maintained incrementally as statistics
+ * arrive, so this just copies the histogram's (fixed number of) buckets.
+ *
+ * @param type      QMF object type to get the histogram for.
+ * @param item      PCP metric item of the statistic to get the histogram of.
+ * @param histogram Set to the histogram.
+ *
+ * @return \c false if \a item is not histogrammed, else \c true.
+ *
+ * @see setHistogramItems
+ */
+bool ConsoleListener::getHistogram(const ConsoleUtils::ObjectSchemaType type,
+                                   const size_t item, Histogram &histogram) const
+{
+    if (type >= ConsoleUtils::Other) {
+        return false;
+    }
+    const std::vector<size_t>::const_iterator iter =
+        std::find(histogramItems[type].begin(), histogramItems[type].end(), item);
+    if (iter == histogramItems[type].end()) {
+        return false;
+    }
+    boost::unique_lock<boost::mutex> lock(objectsMutex);
+    histogram = histograms[type][iter - histogramItems[type].begin()];
+    return true;
+}
+
+/**
+ * @brief Set the statistics to histogram for objects of a given type.
+ *
+ * Each object's latest value of each item is counted in that item's histogram
+ * for as long as the object is known (ie until it is deleted, evicted, or
+ * retired). Like setLayout, this should be called before start.
+ *
+ * @param type  QMF object type to set the histogrammed items for.
+ * @param items PCP metric items, in the type's statistics layout, to histogram.
+ *
+ * @see getHistogram
+ */
+void ConsoleListener::setHistogramItems(const ConsoleUtils::ObjectSchemaType type,
+                                        const std::vector<size_t> &items)
+{
+    if (type < ConsoleUtils::Other) {
+        histogramItems[type] = items;
+        histograms[type].assign(items.size(), Histogram());
+    }
+}
+
+/**
+ * @brief Set the record layout for objects of a given type.
+ *
+ * The layout determines which QMF attributes are decoded into each ObjectRecord
+ * and so, by omission, which attributes are discarded. This should be set for
+ * all supported types before any brokers are added to the session.
+ *
+ * @param type       QMF object type to set the layout for.
+ * @param statistics \c true to set the statistics layout, \c false to set the
+ *                   properties layout.
+ * @param layout     Attributes to decode, indexed by PCP metric item.
+ */
+void ConsoleListener::setLayout(const ConsoleUtils::ObjectSchemaType type,
+                                const bool statistics,
+                                const ObjectRecord::Layout &layout)
+{
+    if (type < ConsoleUtils::Other) {
+        layouts[type][statistics ? 1 : 0] = layout;
+    }
+}
+
+/**
+ * @brief Set the maximum number of objects with pending updates.
+ *
+ * Updates arriving while the update threads are busy are buffered, and
+ * coalesced, per object. This limits how many objects may be buffered at once
+ * (shared evenly between the update threads), beyond which further statistics
+ * updates are dropped (see UpdateBuffer).
+ *
+ * This must be called before start to have any effect.
+ *
+ * @param max Maximum number of objects with pending updates.
+ */
+void ConsoleListener::setMaxPendingUpdates(const size_t max)
+{
+    maxPendingUpdates = max;
+}
+
+/**
+ * @brief Set the number of threads to decode and apply QMF updates with.
+ *
+ * Objects are shared between the threads by object ID, so that each object's
+ * updates are always applied, in order, by the same thread.
+ *
+ * This must be called before start to have any effect.
+ *
+ * @param threads Number of update threads (at least one will be used).
+ */
+void ConsoleListener::setUpdateThreads(const size_t threads)
+{
+    updateThreadCount = std::max<size_t>(threads, 1);
+}
+
+/**
+ * @brief Get the total number of QMF updates coalesced so far.
+ *
+ * @return The number of updates superseded before being applied.
+ */
+uint64_t ConsoleListener::getCoalescedUpdates() const
+{
+    uint64_t total = 0;
+    for (std::vector<boost::shared_ptr<UpdateBuffer> >::const_iterator iter = updates.begin();
+         iter != updates.end(); ++iter)
+    {
+        total += (*iter)->getCoalescedCount();
+    }
+    return total;
+}
+
+/**
+ * @brief Get the total number of QMF updates dropped so far.
+ *
+ * @return The number of updates dropped due to too many pending updates.
+ */
+uint64_t ConsoleListener::getDroppedUpdates() const
+{
+    uint64_t total = 0;
+    for (std::vector<boost::shared_ptr<UpdateBuffer> >::const_iterator iter = updates.begin();
+         iter != updates.end(); ++iter)
+    {
+        total += (*iter)->getDroppedCount();
+    }
+    return total;
+}
+
+/**
+ * @brief Get the number of QMF objects with updates not yet applied.
+ *
+ * @return The number of objects with pending updates.
+ */
+size_t ConsoleListener::getPendingUpdates() const
+{
+    size_t total = 0;
+    for (std::vector<boost::shared_ptr<UpdateBuffer> >::const_iterator iter = updates.begin();
+         iter != updates.end(); ++iter)
+    {
+        total += (*iter)->getPendingCount();
+    }
+    return total;
+}
+
+/**
+ * @brief Get the current update generation.
+ *
+ * The generation increases whenever updates are applied, so callers may
+ * safely reuse anything derived from this listener's objects for
+ * as long as the generation remains unchanged.
+ *
+ * @return The current update generation.
+ */
+uint64_t ConsoleListener::getGeneration() const
+{
+    boost::unique_lock<boost::mutex> lock(generationsMutex);
+    return generation;
+}
+
+/**
+ * @brief Take the next newly connected broker.
+ *
+ * This function blocks until a broker connects, or stop is called. It allows
+ * the owning PMDA to prime newly connected brokers' objects via getObjects
+ * queries, which cannot be made from within the QMF callbacks themselves.
+ *
+ * @param url Set to the newly connected broker's URL.
+ *
+ * @return \c false if stop has been called, otherwise \c true.
+ *
+ * @see brokerConnected
+ */
+bool ConsoleListener::takeConnectedBroker(std::string &url)
+{
+    boost::unique_lock<boost::mutex> lock(connectedBrokersMutex);
+    while ((connectedBrokers.empty()) && (!stopped)) {
+        connectedBrokersCondition.wait(lock);
+    }
+    if (stopped) {
+        return false;
+    }
+    url = connectedBrokers.front();
+    connectedBrokers.pop();
+    return true;
+}
+
+/**
+ * @brief Invoked when a connection is established to a broker.
+ *
+ * We override this QMF callback function to queue the broker for priming.
+ *
+ * @param broker Connected broker.
+ *
+ * @see takeConnectedBroker
+ */
+void ConsoleListener::brokerConnected(const qpid::console::Broker &broker)
+{
+    // Let the super implementation log the connection.
+    ConsoleLogger::brokerConnected(broker);
+
+    {
+        boost::unique_lock<boost::mutex> lock(connectedBrokersMutex);
+        connectedBrokers.push(broker.getUrl());
+        ++connectedCount;
+        ++connectCount;
+    }
+    connectedBrokersCondition.notify_one();
+}
+
+/**
+ * @brief Invoked when the connection to a broker is lost.
+ *
+ * We override this QMF callback function to track connection health.
+ *
+ * @param broker Disconnected broker.
+ *
+ * @see isConnected
+ */
+void ConsoleListener::brokerDisconnected(const qpid::console::Broker &broker)
+{
+    // Let the super implementation log the disconnection.
+    ConsoleLogger::brokerDisconnected(broker);
+
+    boost::unique_lock<boost::mutex> lock(connectedBrokersMutex);
+    if (connectedCount > 0) {
+        --connectedCount;
+    }
+}
+
+/**
+ * @brief Is any broker currently connected?
+ *
+ * @return \c true if at least one broker is currently connected.
+ */
+bool ConsoleListener::isConnected() const
+{
+    boost::unique_lock<boost::mutex> lock(connectedBrokersMutex);
+    return (connectedCount > 0);
+}
+
+/**
+ * @brief Get the number of broker connections made so far.
+ *
+ * @return The number of times any broker has connected, including reconnects.
+ */
+uint64_t ConsoleListener::getConnectCount() const
+{
+    boost::unique_lock<boost::mutex> lock(connectedBrokersMutex);
+    return connectCount;
+}
+
+/**
+ * @brief Get the time updates were last applied, for any broker.
+ *
+ * @return The time updates were last applied, or \c 0 if none have been.
+ */
+time_t ConsoleListener::getLastUpdateTime() const
+{
+    boost::unique_lock<boost::mutex> lock(generationsMutex);
+    return lastUpdateTime;
+}
+
+/**
+ * @brief Get the time updates were last applied for objects of a given type.
+ *
+ * @param type QMF object type.
+ *
+ * @return The time updates were last applied for objects of type \a type, or
+ *         \c 0 if none have been.
+ */
+time_t ConsoleListener::getLastUpdateTime(const ConsoleUtils::ObjectSchemaType type) const
+{
+    boost::unique_lock<boost::mutex> lock(generationsMutex);
+    return (type < ConsoleUtils::Other) ? lastUpdateTimes[type] : 0;
+}
+
 /**
  * @brief Invoked when an object's propeties are updated.
  *
- * We override this QMF callback function to record the supplied properties
+ * We override this QMF callback function to buffer the supplied properties
  * object for any QMF objects of interest (ie those for which isSupported
- * returns \c  true).
+ * returns \c  true). The update is applied later, by the update thread.
  *
  * @param broker Broker advertising the updated object.
  * @param object Updated QMF object.
  *
  * @see isSupported
+ * @see applyProps
  */
 void ConsoleListener::objectProps(qpid::console::Broker &broker,
                                   qpid::console::Object &object)
@@ -146,40 +713,26 @@ void ConsoleListener::objectProps(qpid::console::Broker &broker,
     // Let the super implementation log the properties.
     ConsoleLogger::objectProps(broker, object);
 
-    // Skip unsupported object types.
-    if (!isSupported(object.getClassKey())) {
-        return;
-    }
-
-    // Skip autoDel queues, unless includeAutoDelete is set.
-    if ((!includeAutoDelete) && (isAutoDelete(object))) {
+    // Skip unsupported object types, and rejected objects.
+    if ((!isSupported(object.getClassKey())) || (isRejected(object))) {
         return;
     }
 
-    // Save the properties for future fetch metrics requests.
-    boost::unique_lock<boost::mutex> lock(propsMutex);
-    const ObjectMap::iterator iter = props.find(object.getObjectId());
-    if (iter == props.end()) {
-        props.insert(std::make_pair(object.getObjectId(), object));
-        __pmNotifyErr(LOG_INFO, "new %s", ConsoleUtils::toString(object).c_str());
-        boost::unique_lock<boost::mutex> lock(newObjectsMutex);
-        newObjects.push(object.getObjectId());
-    } else {
-        iter->second = object;
-    }
+    pushUpdate(object, false);
 }
 
 /**
  * @brief Invoked when an object's statistics are updated.
  *
- * We override this QMF callback function to record the supplied statistics
+ * We override this QMF callback function to buffer the supplied statistics
  * object for any QMF objects of interest (ie those for which isSupported
- * returns \c  true).
+ * returns \c  true). The update is applied later, by the update thread.
  *
  * @param broker Broker advertising the updated object.
  * @param object Updated QMF object.
  *
  * @see isSupported
+ * @see applyStats
  */
 void ConsoleListener::objectStats(qpid::console::Broker &broker,
                                   qpid::console::Object &object)
@@ -187,35 +740,472 @@ void ConsoleListener::objectStats(qpid::console::Broker &broker,
     // Let the super implementation log the properties.
     ConsoleLogger::objectStats(broker, object);
 
-    // Skip unsupported object types.
-    if (!isSupported(object.getClassKey())) {
+    // Skip unsupported object types, and rejected objects.
+    if ((!isSupported(object.getClassKey())) || (isRejected(object))) {
+        return;
+    }
+
+    if ((!pushUpdate(object, true)) && (pmDebug & DBG_TRACE_APPL1)) {
+        __pmNotifyErr(LOG_DEBUG, "dropped statistics for %s; too many pending updates",
+                      ConsoleUtils::toString(object).c_str());
+    }
+}
+
+/**
+ * @brief Apply a buffered properties update.
+ *
+ * @note Each object's updates are only ever applied by its own update thread
+ *       (see pushUpdate), so no other thread can race this one to report the
+ *       same new object.
+ *
+ * @param object Updated QMF properties object.
+ */
+void ConsoleListener::applyProps(const qpid::console::Object &object)
+{
+    // Filter new objects, once: skip autoDel queues (unless includeAutoDelete
+    // is set), and any objects not included by the queue filters.
+    const bool deleted = (object.getDeleteTime() != 0);
+    ObjectEntry::Ptr entry = findObject(object, false);
+    if ((!entry) && (((!includeAutoDelete) && (isAutoDelete(object))) || (!isIncluded(object)))) {
+        reject(object);
         return;
     }
 
-    // Skip autoDel queues, unless includeAutoDelete is set.
-    if (!includeAutoDelete) {
-        // We need the props object (not stats) to determine the autoDel status.
-        boost::unique_lock<boost::mutex> lock(propsMutex);
-        const ObjectMap::const_iterator iter = props.find(object.getObjectId());
-        if (iter == props.end()) {
-            if (pmDebug & DBG_TRACE_APPL1) {
-                // This happens because objectProps above, skipped this object appropriately.
-                __pmNotifyErr(LOG_DEBUG, "ignoring statistics for %s since we have no properties",
-                              ConsoleUtils::toString(object).c_str());
+    // Skip objects deleted before we ever saw them (eg short-lived queues).
+    if (!entry) {
+        entry = findObject(object, !deleted);
+    }
+    if (!entry) {
+        return;
+    }
+
+    // Save the properties for future fetch metrics requests.
+    const ObjectRecord::Layout &layout = layouts[ConsoleUtils::getType(object)][0];
+    const ObjectEntry::Snapshot snapshot = ObjectEntry::createSnapshot(object, layout, namePrefix);
+    const bool isNew = !entry->getProps();
+    entry->setProps(snapshot);
+    if (isNew) {
+        __pmNotifyErr(LOG_INFO, "new %s", ConsoleUtils::toString(object).c_str());
+        boost::unique_lock<boost::mutex> lock(newObjectsMutex);
+        newObjects.push_back(entry);
+    }
+
+    if (deleted) {
+        markDeleted(entry, object);
+    }
+}
+
+/**
+ * @brief Apply a buffered statistics update.
+ *
+ * @param object Updated QMF statistics object.
+ */
+void ConsoleListener::applyStats(const qpid::console::Object &object)
+{
+    // Skip autoDel queues, unless includeAutoDelete is set, and filtered queues.
+    // We need the props object (not stats) to determine the autoDel status and
+    // name, but applyProps above never records the properties of such objects.
+    const bool deleted = (object.getDeleteTime() != 0);
+    const bool filtered = ((!queueIncludes.empty()) || (!queueExcludes.empty()));
+    const ObjectEntry::Ptr entry = findObject(object, includeAutoDelete && !filtered && !deleted);
+    if ((!entry) || (((!includeAutoDelete) || (filtered)) && (!entry->getProps()))) {
+        if (pmDebug & DBG_TRACE_APPL1) {
+            // This happens because applyProps above, skipped this object appropriately.
+            __pmNotifyErr(LOG_DEBUG, "ignoring statistics for %s since we have no properties",
+                          ConsoleUtils::toString(object).c_str());
+        }
+        return;
+    }
+
+    // Save the statistics for future fetch metrics requests. Only properties
+    // snapshots' names are ever used, so statistics are not name-prefixed.
+    const ObjectRecord::Layout &layout = layouts[ConsoleUtils::getType(object)][1];
+    updateStats(entry, ObjectEntry::createSnapshot(object, layout));
+
+    if (deleted) {
+        markDeleted(entry, object);
+    }
+}
+
+/**
+ * @brief Buffer a QMF update for the update thread responsible for its object.
+ *
+ * @param object     Updated QMF object.
+ * @param statistics \c true if \a object is a statistics update, \c false if
+ *                   it is a properties update.
+ *
+ * @return \c false if the update was dropped, otherwise \c true.
+ */
+bool ConsoleListener::pushUpdate(const qpid::console::Object &object, const bool statistics)
+{
+    if (updates.empty()) {
+        return false; // Not started yet.
+    }
+    const size_t shard = ConsoleUtils::hash(object.getObjectId()) % updates.size();
+    return updates[shard]->push(object, statistics);
+}
+
+/**
+ * @brief Apply buffered updates, until stopped.
+ *
+ * This is the body of each update thread. Each object's properties are applied
+ * before its statistics, so that statistics arriving in the same batch as the
+ * object's first properties are not ignored.
+ *
+ * Once each batch has been applied, the generation is advanced by the number
+ * of updates in the batch (see getGeneration).
+ *
+ * @param buffer Buffer of updates for this thread to apply.
+ *
+ * @see start
+ */
+void ConsoleListener::applyUpdates(const boost::shared_ptr<UpdateBuffer> buffer)
+{
+    std::vector<UpdateBuffer::Update> batch;
+    while (buffer->take(batch)) {
+        uint64_t batchUpdates = 0;
+        unsigned int batchTypes = 0;
+        for (std::vector<UpdateBuffer::Update>::const_iterator iter = batch.begin();
+             iter != batch.end(); ++iter)
+        {
+            if (iter->props) {
+                applyProps(*iter->props);
+                ++batchUpdates;
+                batchTypes |= 1u << ConsoleUtils::getType(*iter->props);
+            }
+            if (iter->stats) {
+                applyStats(*iter->stats);
+                ++batchUpdates;
+                batchTypes |= 1u << ConsoleUtils::getType(*iter->stats);
             }
-            return;
-        } else if (isAutoDelete(iter->second)) {
-            return;
         }
+        advanceGeneration(batchUpdates, batchTypes);
     }
+}
 
-    // Save the statistics for future fetch metrics requests.
-    boost::unique_lock<boost::mutex> lock(statsMutex);
-    const ObjectMap::iterator iter = stats.find(object.getObjectId());
-    if (iter == stats.end()) {
-        stats.insert(std::make_pair(object.getObjectId(), object));
+/**
+ * @brief Apply complete QMF objects, such as those returned by a getObjects
+ *        query, and wait for them to be applied.
+ *
+ * Each object's properties and statistics are buffered for the object's update
+ * thread, just as if they had been received via objectProps and objectStats.
+ * So query results are applied in order with any updates already buffered for
+ * the same objects, rather than racing them (and possibly being overwritten by
+ * older updates), and each object is still only ever applied by one thread.
+ *
+ * This function returns once all of the objects have been applied (or dropped,
+ * if the update buffers are full), or stop is called.
+ *
+ * @param objects QMF objects to apply.
+ */
+void ConsoleListener::applyObjects(const qpid::console::Object::Vector &objects)
+{
+    for (qpid::console::Object::Vector::const_iterator iter = objects.begin();
+         iter != objects.end(); ++iter)
+    {
+        if ((isSupported(iter->getClassKey())) && (!isRejected(*iter))) {
+            pushUpdate(*iter, false);
+            pushUpdate(*iter, true);
+        }
+    }
+    for (std::vector<boost::shared_ptr<UpdateBuffer> >::const_iterator iter = updates.begin();
+         iter != updates.end(); ++iter)
+    {
+        (*iter)->flush();
+    }
+}
+
+/**
+ * @brief Advance the generation, after applying a batch of updates.
+ *
+ * @param batchUpdates Number of updates applied.
+ * @param batchTypes   Bit mask of the QMF object types updated, with bit \c n
+ *                     set for ConsoleUtils::ObjectSchemaType \c n.
+ *
+ * @see getGeneration
+ * @see getLastUpdateTime
+ */
+void ConsoleListener::advanceGeneration(const uint64_t batchUpdates, const unsigned int batchTypes)
+{
+    if (batchUpdates == 0) {
+        return;
+    }
+    const time_t now = time(NULL);
+    boost::unique_lock<boost::mutex> lock(generationsMutex);
+    generation += batchUpdates;
+    for (int type = 0; type < ConsoleUtils::Other; ++type) {
+        if (batchTypes & (1u << type)) {
+            lastUpdateTimes[type] = now;
+        }
+    }
+    lastUpdateTime = now;
+}
+
+/**
+ * @brief Find the entry for a QMF object.
+ *
+ * Finding an object marks it as the most recently active object of its type.
+ *
+ * @param object QMF object to find the entry for.
+ * @param create If \c true, and \a object is not yet known, a new (empty)
+ *               entry will be created for it, evicting the least recently
+ *               active object of the same type if necessary.
+ *
+ * @return The entry for \a object, or a NULL pointer if not found (and
+ *         \a create is \c false), or if \a object has been evicted.
+ *
+ * @see setMaxObjects
+ */
+ObjectEntry::Ptr ConsoleListener::findObject(const qpid::console::Object &object,
+                                             const bool create)
+{
+    const qpid::console::ObjectId &id = object.getObjectId();
+    boost::unique_lock<boost::mutex> lock(objectsMutex);
+    const ObjectIndex::iterator iter = objects.find(id);
+    if (iter != objects.end()) {
+        RecentList &recent = recentObjects[iter->second.type];
+        recent.splice(recent.end(), recent, iter->second.recent);
+        return iter->second.entry;
+    }
+
+    // Ignore evicted objects, until the broker deletes them.
+    const ObjectIdSet::iterator evicted = evictedObjects.find(id);
+    if (evicted != evictedObjects.end()) {
+        if (object.getDeleteTime() != 0) {
+            evictedObjects.erase(evicted);
+        }
+        return ObjectEntry::Ptr();
+    }
+
+    ObjectEntry::Ptr entry;
+    if (create) {
+        const ConsoleUtils::ObjectSchemaType type = ConsoleUtils::getType(object);
+        if ((maxObjects[type] > 0) && (objectCounts[type] >= maxObjects[type])) {
+            evictObject(type);
+        }
+        entry = ObjectEntry::create(id);
+        IndexedObject indexed;
+        indexed.entry = entry;
+        indexed.type = type;
+        indexed.recent = recentObjects[type].insert(recentObjects[type].end(), id);
+        objects.insert(std::make_pair(id, indexed));
+        ++objectCounts[type];
+    }
+    return entry;
+}
+
+/**
+ * @brief Evict the least recently active object of a given type.
+ *
+ * The evicted object's counters are added to the type's "<other>" object,
+ * (which is created, and reported via takeNewObjects, on first use) and the
+ * evicted object is reported via takeExpiredObjects.
+ *
+ * @note The caller must hold objectsMutex.
+ *
+ * @param type QMF object type to evict an object of.
+ */
+void ConsoleListener::evictObject(const ConsoleUtils::ObjectSchemaType type)
+{
+    if (recentObjects[type].empty()) {
+        return;
+    }
+    const ObjectIndex::iterator iter = objects.find(recentObjects[type].front());
+    const ObjectEntry::Ptr entry = iter->second.entry;
+    recentObjects[type].pop_front();
+    --objectCounts[type];
+    objects.erase(iter);
+    ++evictedCount;
+
+    // Fold the evicted object's counters into the "<other>" object.
+    ObjectEntry::Ptr &overflow = overflowObjects[type];
+    if (!overflow) {
+        overflow = ObjectEntry::create(qpid::console::ObjectId());
+        overflow->setProps(ObjectEntry::createSnapshot(type, namePrefix + "<other>"));
+        overflow->setStats(ObjectEntry::createSnapshot(type, namePrefix + "<other>"));
+        boost::unique_lock<boost::mutex> lock(newObjectsMutex);
+        newObjects.push_back(overflow);
+    }
+    // Its counters stay in the aggregates, as part of "<other>", but it is no
+    // longer a queue (etc) in its own right, so its other statistics leave the
+    // aggregates, and it leaves the histograms.
+    const ObjectEntry::Snapshot stats = entry->getStats();
+    if (stats) {
+        overflow->setStats(ObjectEntry::createSnapshot(*overflow->getStats(), *stats,
+                                                       layouts[type][1]));
+        dropStats(type, stats);
+    }
+
+    if (pmDebug & DBG_TRACE_APPL0) {
+        __pmNotifyErr(LOG_DEBUG, "evicted %s",
+                      ConsoleUtils::toString(entry->getObjectId()).c_str());
+    }
+    if (!entry->isDeleted()) {
+        // Remember the object until the broker deletes it, to ignore its updates,
+        // but forget the oldest such objects beyond maxEvictedObjects.
+        evictedObjects.insert(entry->getObjectId());
+        evictedOrder.push_back(entry->getObjectId());
+        while (evictedOrder.size() > maxEvictedObjects) {
+            evictedObjects.erase(evictedOrder.front());
+            evictedOrder.pop_front();
+        }
+    }
+    boost::unique_lock<boost::mutex> lock(deletedObjectsMutex);
+    droppedObjects.push_back(entry);
+}
+
+/**
+ * @brief Publish a new statistics snapshot for an object, updating aggregates
+ *        and histograms.
+ *
+ * If the object is still known (ie not evicted, nor retired, since its update
+ * arrived), the difference between its old and new statistics is applied to
+ * the aggregates, so that they always total the latest statistics of all known
+ * objects, plus the last counters of all objects since deleted or evicted (see
+ * dropStats), without ever needing to be recalculated. Likewise, the object is
+ * moved from its old values' histogram buckets to its new values' buckets.
+ *
+ * The swap is done under objectsMutex, so that the difference applied is always
+ * from the snapshot last counted, even as the object is concurrently evicted,
+ * expired or retired.
+ *
+ * @param entry Entry of the updated object.
+ * @param stats New statistics snapshot.
+ *
+ * @see getAggregate
+ * @see getHistogram
+ */
+void ConsoleListener::updateStats(const ObjectEntry::Ptr &entry,
+                                  const ObjectEntry::Snapshot &stats)
+{
+    boost::unique_lock<boost::mutex> lock(objectsMutex);
+    const ObjectIndex::const_iterator iter = objects.find(entry->getObjectId());
+    if ((iter != objects.end()) && (iter->second.entry == entry)) {
+        countStats(iter->second.type, entry->getStats(), true);
+        countStats(iter->second.type, stats);
+    }
+    entry->setStats(stats);
+}
+
+/**
+ * @brief Add (or remove) an object's statistics to (or from) the aggregates
+ *        and histograms.
+ *
+ * The caller must hold objectsMutex.
+ *
+ * @param type   QMF object type of the statistics.
+ * @param stats  Statistics snapshot to count, if any.
+ * @param remove \c true to remove \a stats, instead of adding.
+ */
+void ConsoleListener::countStats(const ConsoleUtils::ObjectSchemaType type,
+                                 const ObjectEntry::Snapshot &stats, const bool remove)
+{
+    if (stats) {
+        stats->addTo(aggregates[type], layouts[type][1], remove);
+        countHistograms(type, stats, remove);
+    }
+}
+
+/**
+ * @brief Remove a removed object's statistics from the aggregates and histograms.
+ *
+ * This is used when an object is evicted, or deleted by the broker. Its
+ * counters are kept in the aggregates though, so that counter totals never
+ * decrease as short-lived queues come and go, just as evicted objects'
+ * counters are kept in "<other>". Objects that are merely retired (see
+ * retireObjects) will be reported again, so are removed in full instead.
+ *
+ * The caller must hold objectsMutex.
+ *
+ * @param type  QMF object type of the statistics.
+ * @param stats Statistics snapshot to remove, if any.
+ */
+void ConsoleListener::dropStats(const ConsoleUtils::ObjectSchemaType type,
+                                const ObjectEntry::Snapshot &stats)
+{
+    if (stats) {
+        stats->addTo(aggregates[type], layouts[type][1], true, false);
+        countHistograms(type, stats, true);
+    }
+}
+
+/**
+ * @brief Add (or remove) an object's statistics to (or from) the histograms.
+ *
+ * The caller must hold objectsMutex.
+ *
+ * @param type   QMF object type of the statistics.
+ * @param stats  Statistics snapshot to count, if any.
+ * @param remove \c true to remove \a stats, instead of adding.
+ *
+ * @see setHistogramItems
+ */
+void ConsoleListener::countHistograms(const ConsoleUtils::ObjectSchemaType type,
+                                      const ObjectEntry::Snapshot &stats, const bool remove)
+{
+    if (!stats) {
+        return;
+    }
+    for (size_t index = 0; index < histogramItems[type].size(); ++index) {
+        const ObjectRecord::Slot * const slot = stats->getSlot(histogramItems[type][index]);
+        uint64_t value;
+        if ((slot != NULL) && (Histogram::getValue(*slot, value))) {
+            if (remove) {
+                histograms[type][index].remove(value);
+            } else {
+                histograms[type][index].add(value);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Get the total of a statistic across all of this listener's objects.
+ *
+ * Aggregates are maintained incrementally as statistics arrive (see
+ * updateStats), so this is a constant-time operation.
+ *
+ * @param type  QMF object type to get the total for.
+ * @param item  PCP metric item of the statistic to total.
+ * @param value Set to the total, typed per the type's statistics layout.
+ *
+ * @return \c false if there is no such numeric statistic, else \c true.
+ */
+bool ConsoleListener::getAggregate(const ConsoleUtils::ObjectSchemaType type,
+                                   const size_t item, pmAtomValue &value) const
+{
+    if ((type >= ConsoleUtils::Other) || (item >= layouts[type][1].size()) ||
+        (layouts[type][1][item].name.empty()) ||
+        (layouts[type][1][item].type == PM_TYPE_STRING)) {
+        return false;
+    }
+    boost::unique_lock<boost::mutex> lock(objectsMutex);
+    if (item < aggregates[type].size()) {
+        value = aggregates[type][item];
     } else {
-        iter->second = object;
+        value.ull = 0; // No statistics received yet.
+    }
+    return true;
+}
+
+/**
+ * @brief Record that an object has been deleted by the broker.
+ *
+ * The object's entry is kept until its grace period expires, at which point it
+ * will be reported via takeExpiredObjects. Calling this function more than once
+ * for the same entry (eg for both properties and statistics) is harmless.
+ *
+ * @param entry  Entry of the deleted object.
+ * @param object The deleted object's final update, for logging.
+ */
+void ConsoleListener::markDeleted(const ObjectEntry::Ptr &entry,
+                                  const qpid::console::Object &object)
+{
+    boost::unique_lock<boost::mutex> lock(deletedObjectsMutex);
+    if (!entry->isDeleted()) {
+        entry->setDeleted();
+        deletedObjects.push_back(std::make_pair(time(NULL), entry));
+        __pmNotifyErr(LOG_INFO, "deleted %s", ConsoleUtils::toString(object).c_str());
     }
 }
 
@@ -263,12 +1253,86 @@ bool ConsoleListener::isAutoDelete(const qpid::console::Object &object)
     return autoDelete->second->asBool();
 }
 
+/**
+ * @brief Is an object included by the queue filters?
+ *
+ * Non-queue objects are always included. Queues are included if their name
+ * matches any of the include globs (or there are none), and none of the
+ * exclude globs.
+ *
+ * @param object QMF properties object to check.
+ *
+ * @return \c true if \a object is included.
+ *
+ * @see setQueueFilters
+ */
+bool ConsoleListener::isIncluded(const qpid::console::Object &object)
+{
+    if (((queueIncludes.empty()) && (queueExcludes.empty())) ||
+        (ConsoleUtils::getType(object) != ConsoleUtils::Queue)) {
+        return true;
+    }
+
+    const std::string name = ConsoleUtils::getName(object);
+    const bool included = ConsoleUtils::matchesGlobs(name, queueIncludes, queueExcludes);
+
+    if (pmDebug & DBG_TRACE_APPL1) {
+        __pmNotifyErr(LOG_DEBUG, "queue %s %s", name.c_str(),
+                      included ? "included" : "excluded");
+    }
+    return included;
+}
+
+/**
+ * @brief Has an object been rejected?
+ *
+ * Rejected objects are forgotten once the broker deletes them, so calling this
+ * with an object's final (deleted) update will return \c true one last time.
+ *
+ * @param object QMF object to check.
+ *
+ * @return \c true if \a object was rejected when first seen.
+ *
+ * @see reject
+ */
+bool ConsoleListener::isRejected(const qpid::console::Object &object)
+{
+    boost::unique_lock<boost::mutex> lock(rejectedObjectsMutex);
+    if (rejectedObjects.empty()) {
+        return false;
+    }
+    const ObjectIdSet::iterator iter = rejectedObjects.find(object.getObjectId());
+    if (iter == rejectedObjects.end()) {
+        return false;
+    }
+    if (object.getDeleteTime() != 0) {
+        rejectedObjects.erase(iter);
+    }
+    return true;
+}
+
+/**
+ * @brief Reject an object, so all of its future updates are discarded.
+ *
+ * @param object QMF object to reject.
+ *
+ * @see isRejected
+ */
+void ConsoleListener::reject(const qpid::console::Object &object)
+{
+    if (object.getDeleteTime() == 0) {
+        boost::unique_lock<boost::mutex> lock(rejectedObjectsMutex);
+        rejectedObjects.insert(object.getObjectId());
+    }
+}
+
 /**
  * @brief Are objects of the given \c classKey supported by this PMDA.
  *
  * Currently, this function assumes that all defined
  * ConsoleUtils::ObjectSchemaType types are supported by this PMDA, except for
- * ConsoleUtils::Other.
+ * ConsoleUtils::Other, and any types with no attributes to decode (ie types
+ * whose metrics have all been deselected; see setLayout).
  *
  * @param classKey QMF class key to check for support.
  *
@@ -278,5 +1342,7 @@ bool ConsoleListener::isAutoDelete(const qpid::console::Object &object)
  */
 bool ConsoleListener::isSupported(const qpid::console::ClassKey &classKey)
 {
-    return (ConsoleUtils::getType(classKey) != ConsoleUtils::Other);
+    const ConsoleUtils::ObjectSchemaType type = ConsoleUtils::getType(classKey);
+    return ((type != ConsoleUtils::Other) &&
+            ((!layouts[type][0].empty()) || (!layouts[type][1].empty())));
 }
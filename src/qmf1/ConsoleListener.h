@@ -23,17 +23,36 @@
 #define __QPID_PMDA_CONSOLE_LISTENER_H__
 
 #include "ConsoleLogger.h"
+#include "Histogram.h"
+#include "ObjectEntry.h"
+#include "UpdateBuffer.h"
 
-#include <boost/optional/optional.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
+#include <deque>
+#include <list>
 #include <queue>
 
 /**
  * @brief QMF console event listener for our Qpid PMDA.
  *
  * This class listens to QMF console events to build and maintain a list of QMF
- * object properties and statistics.
+ * object properties and statistics. Each incoming object is decoded, once, into
+ * an ObjectRecord, according to the layout set for its type via setLayout, and
+ * published via the object's ObjectEntry.
+ *
+ * The QMF callbacks themselves do very little: supported objects are pushed to
+ * a bounded, coalescing UpdateBuffer, and decoded by a pool of update threads
+ * (see start), so that a slow decode never stalls the QMF client's I/O, and
+ * updates superseded while waiting are never decoded at all. Each object is
+ * always handled by the same update thread, so its updates (including results
+ * of any getObjects queries, see applyObjects) are applied in the order they
+ * arrived.
  *
  * Currently this class only tracks objects of type listes as support by the
  * isSupported function - that is, brokers, queues and systems.
@@ -43,40 +62,205 @@ class ConsoleListener : public ConsoleLogger {
 public:
     ConsoleListener();
 
-    boost::optional<qpid::console::ObjectId> getNewObjectId();
+    virtual ~ConsoleListener();
+
+    void start();
 
-    boost::optional<qpid::console::Object> getProps(const qpid::console::ObjectId &id);
+    void stop();
 
-    boost::optional<qpid::console::Object> getStats(const qpid::console::ObjectId &id);
+    size_t takeNewObjects(std::vector<ObjectEntry::Ptr> &entries);
+
+    void setNamePrefix(const std::string &prefix);
 
     void setIncludeAutoDelete(const bool include = true);
 
+    void setQueueFilters(const std::vector<std::string> &include,
+                         const std::vector<std::string> &exclude);
+
+    size_t getRejectedCount() const;
+
+    void setDeleteGracePeriod(const time_t seconds);
+
+    size_t takeExpiredObjects(std::vector<ObjectEntry::Ptr> &expired);
+
+    size_t retireObjects();
+
+    void releaseRetiredObjects();
+
+    void setMaxObjects(const ConsoleUtils::ObjectSchemaType type, const size_t max);
+
+    void setMaxEvictedObjects(const size_t max);
+
+    uint64_t getEvictedCount() const;
+
+    bool getAggregate(const ConsoleUtils::ObjectSchemaType type, const size_t item,
+                      pmAtomValue &value) const;
+
+    bool getHistogram(const ConsoleUtils::ObjectSchemaType type, const size_t item,
+                      Histogram &histogram) const;
+
+    void setHistogramItems(const ConsoleUtils::ObjectSchemaType type,
+                           const std::vector<size_t> &items);
+
+    void setLayout(const ConsoleUtils::ObjectSchemaType type, const bool statistics,
+                   const ObjectRecord::Layout &layout);
+
+    void setMaxPendingUpdates(const size_t max);
+
+    void setUpdateThreads(const size_t threads);
+
+    uint64_t getCoalescedUpdates() const;
+
+    uint64_t getDroppedUpdates() const;
+
+    size_t getPendingUpdates() const;
+
+    uint64_t getGeneration() const;
+
+    time_t getLastUpdateTime() const;
+
+    time_t getLastUpdateTime(const ConsoleUtils::ObjectSchemaType type) const;
+
+    void applyObjects(const qpid::console::Object::Vector &objects);
+
+    bool takeConnectedBroker(std::string &url);
+
+    bool isConnected() const;
+
+    uint64_t getConnectCount() const;
+
     /* Overrides for qpid::console::ConsoleListener events below here */
 
+    virtual void brokerConnected(const qpid::console::Broker &broker);
+
+    virtual void brokerDisconnected(const qpid::console::Broker &broker);
+
     virtual void objectProps(qpid::console::Broker &broker, qpid::console::Object &object);
 
     virtual void objectStats(qpid::console::Broker &broker, qpid::console::Object &object);
 
 protected:
-    bool includeAutoDelete; ///< Whether or not to include auto-delete objects.
+    std::string namePrefix;   ///< Prefix for all decoded objects' properties' names.
+    bool includeAutoDelete;   ///< Whether or not to include auto-delete objects.
+    std::vector<std::string> queueIncludes; ///< Globs of queue names to include.
+    std::vector<std::string> queueExcludes; ///< Globs of queue names to exclude.
+    time_t deleteGracePeriod; ///< Seconds to keep objects after deletion.
 
     virtual bool isAutoDelete(const qpid::console::Object &object);
 
     virtual bool isSupported(const qpid::console::ClassKey &classKey);
 
+    virtual bool isIncluded(const qpid::console::Object &object);
+
+    bool isRejected(const qpid::console::Object &object);
+
+    void reject(const qpid::console::Object &object);
+
+    virtual void applyProps(const qpid::console::Object &object);
+
+    virtual void applyStats(const qpid::console::Object &object);
+
+    void applyUpdates(const boost::shared_ptr<UpdateBuffer> buffer);
+
+    bool pushUpdate(const qpid::console::Object &object, const bool statistics);
+
+    void advanceGeneration(const uint64_t batchUpdates, const unsigned int batchTypes);
+
+    ObjectEntry::Ptr findObject(const qpid::console::Object &object, const bool create);
+
+    void evictObject(const ConsoleUtils::ObjectSchemaType type);
+
+    void markDeleted(const ObjectEntry::Ptr &entry, const qpid::console::Object &object);
+
+    void updateStats(const ObjectEntry::Ptr &entry, const ObjectEntry::Snapshot &stats);
+
+    void countStats(const ConsoleUtils::ObjectSchemaType type,
+                    const ObjectEntry::Snapshot &stats, const bool remove = false);
+
+    void dropStats(const ConsoleUtils::ObjectSchemaType type, const ObjectEntry::Snapshot &stats);
+
+    void countHistograms(const ConsoleUtils::ObjectSchemaType type,
+                         const ObjectEntry::Snapshot &stats, const bool remove = false);
+
 private:
-    /// A simple map of QMF object IDs to QMF objects.
-    typedef std::map<qpid::console::ObjectId, qpid::console::Object> ObjectMap;
+    /// Known QMF objects, most recently active last.
+    typedef std::list<qpid::console::ObjectId> RecentList;
 
-    ObjectMap props;         ///< Known QMF object properties.
-    ObjectMap stats;         ///< Known QMF object statistics.
-    boost::mutex propsMutex; ///< Protects access to props.
-    boost::mutex statsMutex; ///< Protects access to stats.
+    /// A known QMF object, as indexed by ObjectIndex.
+    struct IndexedObject {
+        ObjectEntry::Ptr entry;              ///< The object's entry.
+        ConsoleUtils::ObjectSchemaType type; ///< The object's type.
+        RecentList::iterator recent;         ///< The object's place in recentObjects.
+    };
 
-    /// IDs of objects not yet reported via getNewObjectId.
-    std::queue<qpid::console::ObjectId> newObjects;
+    /// A hashed index of QMF object IDs to known QMF objects.
+    typedef boost::unordered_map<qpid::console::ObjectId, IndexedObject,
+                                 ConsoleUtils::ObjectIdHash> ObjectIndex;
+
+    /// A hashed set of QMF object IDs.
+    typedef boost::unordered_set<qpid::console::ObjectId, ConsoleUtils::ObjectIdHash> ObjectIdSet;
+
+    /// Record layouts, indexed by object type, then statistics (or not).
+    ObjectRecord::Layout layouts[ConsoleUtils::Other][2];
+
+    size_t maxPendingUpdates; ///< Maximum objects with pending updates.
+    size_t updateThreadCount; ///< Number of update threads to start.
+
+    /// Updates not yet applied, sharded by object ID, one per update thread.
+    std::vector<boost::shared_ptr<UpdateBuffer> > updates;
+    boost::thread_group updateThreads; ///< Threads applying updates.
+
+    uint64_t generation; ///< Number of updates applied so far.
+    time_t lastUpdateTime; ///< Time updates were last applied.
+    time_t lastUpdateTimes[ConsoleUtils::Other]; ///< Time updates were last applied, by type.
+    mutable boost::mutex generationsMutex; ///< Protects the generation and update times.
+
+    ObjectIndex objects;       ///< Known QMF objects.
+    RecentList recentObjects[ConsoleUtils::Other]; ///< Known objects, by type.
+    size_t objectCounts[ConsoleUtils::Other];      ///< Known objects, by type.
+    size_t maxObjects[ConsoleUtils::Other];        ///< Object limits, by type.
+    ObjectEntry::Ptr overflowObjects[ConsoleUtils::Other]; ///< Evicted totals.
+    size_t maxEvictedObjects;   ///< Maximum evicted objects to remember.
+    ObjectIdSet evictedObjects; ///< Evicted objects not yet deleted (nor forgotten).
+    std::deque<qpid::console::ObjectId> evictedOrder; ///< Evicted objects, oldest first.
+    uint64_t evictedCount;      ///< Number of objects evicted so far.
+    std::vector<ObjectEntry::Ptr> retiredObjects; ///< Objects retired, not yet released.
+
+    /// Statistics totals of all known objects (plus deleted and evicted objects' counters), by type, then item.
+    std::vector<pmAtomValue> aggregates[ConsoleUtils::Other];
+
+    /// Statistics items to histogram, by type (set before start).
+    std::vector<size_t> histogramItems[ConsoleUtils::Other];
+
+    /// Histograms of known objects' statistics, by type, then histogramItems index.
+    std::vector<Histogram> histograms[ConsoleUtils::Other];
+    mutable boost::mutex objectsMutex; ///< Protects access to all of the above.
+
+    /// Objects rejected by isAutoDelete or isIncluded, and not yet deleted.
+    ObjectIdSet rejectedObjects;
+    mutable boost::mutex rejectedObjectsMutex; ///< Protects rejectedObjects.
+
+    /// Brokers connected, but not yet reported via takeConnectedBroker.
+    std::queue<std::string> connectedBrokers;
+    bool stopped; ///< Has stop been called?
+    size_t connectedCount; ///< Number of brokers currently connected.
+    uint64_t connectCount; ///< Number of broker connections made so far.
+    mutable boost::mutex connectedBrokersMutex; ///< Protects the above.
+    boost::condition_variable connectedBrokersCondition; ///< Signalled on connect and stop.
+
+    /// Objects not yet reported via takeNewObjects.
+    std::vector<ObjectEntry::Ptr> newObjects;
     boost::mutex newObjectsMutex; ///< Protects access to newObjects.
 
+    /// Deleted objects, and the times they were deleted, oldest first.
+    std::deque<std::pair<time_t, ObjectEntry::Ptr> > deletedObjects;
+
+    /// Evicted and released objects not yet reported via takeExpiredObjects.
+    std::vector<ObjectEntry::Ptr> droppedObjects;
+
+    /// Protects access to deletedObjects and droppedObjects.
+    boost::mutex deletedObjectsMutex;
+
 };
 
 #endif
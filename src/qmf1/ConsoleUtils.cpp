@@ -21,10 +21,11 @@
 
 #include "ConsoleUtils.h"
 
-#include <qpid/console/Value.h>
-
+#include <boost/functional/hash.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <fnmatch.h>
+
 /**
  * @brief Get a standardised name for a QMF object.
  *
@@ -51,6 +52,26 @@ std::string ConsoleUtils::getName(const qpid::console::Object &object,
     return (name == attributes.end()) ? std::string() : name->second->asString();
 }
 
+/**
+ * @brief Get the QMF class name of a schema type.
+ *
+ * This is the inverse of getType. All supported types are classes in the
+ * "org.apache.qpid.broker" package.
+ *
+ * @param type Schema type to get the class name of.
+ *
+ * @return The QMF class name of \a type, or an empty string for Other.
+ */
+std::string ConsoleUtils::getClassName(const ObjectSchemaType type)
+{
+    switch (type) {
+        case Broker: return "broker";
+        case Queue:  return "queue";
+        case System: return "system";
+        default:     return std::string();
+    }
+}
+
 /**
  * @brief Get the schema type of a QMF object.
  *
@@ -81,6 +102,54 @@ ConsoleUtils::ObjectSchemaType ConsoleUtils::getType(const qpid::console::ClassK
     return Other;
 }
 
+/**
+ * @brief Hash a QMF object ID.
+ *
+ * This allows QMF object IDs to be used as keys in hashed containers, such as
+ * boost::unordered_map.
+ *
+ * @param id QMF object ID to hash.
+ *
+ * @return A hash of \a id.
+ */
+size_t ConsoleUtils::hash(const qpid::console::ObjectId &id)
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, id.getObjectNum());
+    boost::hash_combine(seed, id.getAgentBank());
+    boost::hash_combine(seed, id.getBrokerBank());
+    return seed;
+}
+
+/**
+ * @brief Does a name match a set of include and exclude globs?
+ *
+ * @param name     Name to check.
+ * @param includes fnmatch globs, any of which \a name must match. If empty, all
+ *                 names are included.
+ * @param excludes fnmatch globs, none of which \a name may match.
+ *
+ * @return \c true if \a name matches any of \a includes (or \a includes is
+ *         empty), and none of \a excludes.
+ */
+bool ConsoleUtils::matchesGlobs(const std::string &name,
+                                const std::vector<std::string> &includes,
+                                const std::vector<std::string> &excludes)
+{
+    bool matched = includes.empty();
+    for (std::vector<std::string>::const_iterator iter = includes.begin();
+         (!matched) && (iter != includes.end()); ++iter)
+    {
+        matched = (fnmatch(iter->c_str(), name.c_str(), 0) == 0);
+    }
+    for (std::vector<std::string>::const_iterator iter = excludes.begin();
+         (matched) && (iter != excludes.end()); ++iter)
+    {
+        matched = (fnmatch(iter->c_str(), name.c_str(), 0) != 0);
+    }
+    return matched;
+}
+
 /**
  * @brief Convert a QMF type code to a human-readable string.
  *
@@ -189,3 +258,31 @@ std::string ConsoleUtils::toString(const qpid::console::SchemaStatistic &statist
     return statistic.name + ':' + qmfTypeCodeToString(statistic.typeCode) + ':' +
            statistic.unit + ':' + statistic.desc;
 }
+
+/**
+ * @brief Convert a QMF value to a string for exporting as a PCP string metric.
+ *
+ * @param value QMF value to convert to string.
+ *
+ * @throw qpid::Exception if \a value cannot be represented as a string.
+ *
+ * @return String representation of \a value.
+ */
+std::string ConsoleUtils::toString(const qpid::console::Value &value)
+{
+    if (value.isBool()) {
+        return value.asBool() ? "true" : "false";
+    } else if (value.isMap()) {
+        std::ostringstream stream;
+        stream << value.asMap();
+        return stream.str();
+    } else if (value.isNull()) {
+        return "null";
+    } else if (value.isObjectId()) {
+        return toString(value.asObjectId());
+    } else if (value.isUuid()) {
+        return value.asUuid().str();
+    } else {
+        return value.asString();
+    }
+}
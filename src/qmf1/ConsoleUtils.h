@@ -25,6 +25,9 @@
 #include <qpid/console/ClassKey.h>
 #include <qpid/console/Object.h>
 #include <qpid/console/Schema.h>
+#include <qpid/console/Value.h>
+
+#include <vector>
 
 /**
  * @brief Collecton of utility functions for working with qpid::console classes.
@@ -39,13 +42,29 @@ public:
         Other
     };
 
+    /// Hashes QMF object IDs for hashed containers (see hash).
+    struct ObjectIdHash {
+        size_t operator()(const qpid::console::ObjectId &id) const
+        {
+            return ConsoleUtils::hash(id);
+        }
+    };
+
     static std::string getName(const qpid::console::Object &object,
                                const bool allowNodeName = true);
 
+    static std::string getClassName(const ObjectSchemaType type);
+
     static ObjectSchemaType getType(const qpid::console::Object &object);
 
     static ObjectSchemaType getType(const qpid::console::ClassKey &classKey);
 
+    static size_t hash(const qpid::console::ObjectId &id);
+
+    static bool matchesGlobs(const std::string &name,
+                             const std::vector<std::string> &includes,
+                             const std::vector<std::string> &excludes);
+
     static std::string qmfTypeCodeToString(const uint8_t typeCode);
 
     static std::string toString(const qpid::console::ClassKey &classKey);
@@ -59,6 +78,8 @@ public:
 
     static std::string toString(const qpid::console::SchemaStatistic &statistic);
 
+    static std::string toString(const qpid::console::Value &value);
+
 };
 
 #endif
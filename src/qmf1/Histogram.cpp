@@ -0,0 +1,216 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file
+ * @brief Defines the Histogram class.
+ */
+
+#include "Histogram.h"
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+/**
+ * @brief Constructor.
+ */
+Histogram::Histogram() : total(0)
+{
+    std::fill(counts, counts + BucketCount, 0);
+}
+
+/**
+ * @brief Add a value to this histogram.
+ *
+ * @param value Value to add.
+ */
+void Histogram::add(const uint64_t value)
+{
+    ++counts[getBucket(value)];
+    ++total;
+}
+
+/**
+ * @brief Add all of another histogram's values to this histogram.
+ *
+ * @param other Histogram to add.
+ */
+void Histogram::add(const Histogram &other)
+{
+    for (size_t bucket = 0; bucket < BucketCount; ++bucket) {
+        counts[bucket] += other.counts[bucket];
+    }
+    total += other.total;
+}
+
+/**
+ * @brief Remove a value previously added to this histogram.
+ *
+ * Removing a value that was never added would leave the histogram corrupt, so
+ * is logged as an error (and otherwise ignored) rather than underflowing the
+ * bucket's count.
+ *
+ * @param value Value to remove.
+ */
+void Histogram::remove(const uint64_t value)
+{
+    const size_t bucket = getBucket(value);
+    if (counts[bucket] == 0) {
+        __pmNotifyErr(LOG_ERR, "cannot remove value %ju from empty histogram bucket %ju",
+                      (uintmax_t)value, (uintmax_t)bucket);
+        return;
+    }
+    --counts[bucket];
+    --total;
+}
+
+/**
+ * @brief Get the number of values in a bucket.
+ *
+ * @param bucket Bucket to get the count of.
+ *
+ * @return The number of values in \a bucket, or 0 if there is no such bucket.
+ */
+uint64_t Histogram::getCount(const size_t bucket) const
+{
+    return (bucket < BucketCount) ? counts[bucket] : 0;
+}
+
+/**
+ * @brief Get the number of values in this histogram.
+ *
+ * @return The number of values in all buckets.
+ */
+uint64_t Histogram::getTotal() const
+{
+    return total;
+}
+
+/**
+ * @brief Get an approximate percentile of this histogram's values.
+ *
+ * The result is the upper bound of the bucket containing the percentile, so it
+ * is never less than the exact percentile, and never more than twice it.
+ *
+ * @param percent Percentile to get, from 0 to 100.
+ * @param value   Set to the approximate percentile.
+ *
+ * @return \c false if this histogram is empty, else \c true.
+ */
+bool Histogram::getPercentile(const unsigned int percent, uint64_t &value) const
+{
+    if (total == 0) {
+        return false;
+    }
+
+    // Nearest-rank method: the smallest value with at least percent% of all
+    // values less than or equal to it.
+    const uint64_t rank = std::max<uint64_t>(1, (total * std::min(percent, 100u) + 99) / 100);
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket < BucketCount; ++bucket) {
+        count += counts[bucket];
+        if (count >= rank) {
+            value = getUpperBound(bucket);
+            return true;
+        }
+    }
+    value = getUpperBound(BucketCount - 1);
+    return true;
+}
+
+/**
+ * @brief Get the bucket a value belongs in.
+ *
+ * @param value Value to get the bucket of.
+ *
+ * @return The bucket for \a value, ie the number of significant bits in \a value.
+ */
+size_t Histogram::getBucket(const uint64_t value)
+{
+    size_t bucket = 0;
+    for (uint64_t remaining = value; remaining != 0; remaining >>= 1) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+/**
+ * @brief Get the largest value that belongs in a bucket.
+ *
+ * @param bucket Bucket to get the upper bound of.
+ *
+ * @return The largest value in \a bucket.
+ */
+uint64_t Histogram::getUpperBound(const size_t bucket)
+{
+    return (bucket >= BucketCount - 1) ? std::numeric_limits<uint64_t>::max()
+                                       : (static_cast<uint64_t>(1) << bucket) - 1;
+}
+
+/**
+ * @brief Get the name of a bucket, for use as a PCP instance name.
+ *
+ * @param bucket Bucket to get the name of.
+ *
+ * @return The range of values in \a bucket, eg "0", "1" or "2-3".
+ */
+std::string Histogram::getBucketName(const size_t bucket)
+{
+    std::ostringstream stream;
+    if (bucket > 1) {
+        stream << (getUpperBound(bucket - 1) + 1) << '-';
+    }
+    stream << getUpperBound(bucket);
+    return stream.str();
+}
+
+/**
+ * @brief Get a decoded metric value as an unsigned histogram value.
+ *
+ * Negative values are treated as zero, and floating point values are
+ * truncated.
+ *
+ * @param slot  Decoded metric value.
+ * @param value Set to the histogram value.
+ *
+ * @return \c false if \a slot has no numeric value, else \c true.
+ */
+bool Histogram::getValue(const ObjectRecord::Slot &slot, uint64_t &value)
+{
+    if (slot.status != 0) {
+        return false;
+    }
+    switch (slot.type) {
+        case PM_TYPE_32:  value = (slot.atom.l  > 0) ? slot.atom.l  : 0; return true;
+        case PM_TYPE_64:  value = (slot.atom.ll > 0) ? slot.atom.ll : 0; return true;
+        case PM_TYPE_U32: value = slot.atom.ul;  return true;
+        case PM_TYPE_U64: value = slot.atom.ull; return true;
+        case PM_TYPE_FLOAT:
+        case PM_TYPE_DOUBLE: {
+            const double atom = (slot.type == PM_TYPE_FLOAT) ? slot.atom.f : slot.atom.d;
+            value = (atom <= 0) ? 0
+                  : (atom >= 18446744073709551615.0) ? std::numeric_limits<uint64_t>::max()
+                  : static_cast<uint64_t>(atom);
+            return true;
+        }
+    }
+    return false;
+}
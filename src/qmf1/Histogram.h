@@ -0,0 +1,76 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * @file
+ * @brief Declares the Histogram class.
+ */
+
+#ifndef __QPID_PMDA_HISTOGRAM_H__
+#define __QPID_PMDA_HISTOGRAM_H__
+
+#include "ObjectRecord.h"
+
+#include <stdint.h>
+
+#include <string>
+
+/**
+ * @brief Log-scale histogram of a population of unsigned values.
+ *
+ * Bucket 0 counts zero values, and bucket \e n (for \e n > 0) counts values
+ * from 2^(n-1) to 2^n - 1, so every 64-bit value has a bucket, and a bucket's
+ * bounds are never more than a factor of two apart.
+ *
+ * Values can be removed as well as added, so that a histogram of the latest
+ * values of many objects can be kept up to date by removing each object's old
+ * value as its new value is added.
+ */
+class Histogram {
+
+public:
+    enum { BucketCount = 65 }; ///< Number of buckets.
+
+    Histogram();
+
+    void add(const uint64_t value);
+
+    void add(const Histogram &other);
+
+    void remove(const uint64_t value);
+
+    uint64_t getCount(const size_t bucket) const;
+
+    uint64_t getTotal() const;
+
+    bool getPercentile(const unsigned int percent, uint64_t &value) const;
+
+    static size_t getBucket(const uint64_t value);
+
+    static uint64_t getUpperBound(const size_t bucket);
+
+    static std::string getBucketName(const size_t bucket);
+
+    static bool getValue(const ObjectRecord::Slot &slot, uint64_t &value);
+
+protected:
+    uint64_t counts[BucketCount]; ///< Number of values in each bucket.
+    uint64_t total;               ///< Number of values in all buckets.
+
+};
+
+#endif
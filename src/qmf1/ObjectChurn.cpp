@@ -0,0 +1,267 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Defines a standalone object churn benchmark.
+ *
+ * This benchmark simulates heavy temporary-queue churn: it keeps a fixed number
+ * of live ObjectEntry instances, each with properties and statistics snapshots
+ * much like a real queue's, and every round replaces half of them (chosen at
+ * random) with new entries of varying name lengths.
+ *
+ * The same churn is run twice, each in its own child process: once with entries
+ * and snapshots allocated via ObjectEntry's pooled factory functions, and once
+ * from the general heap. The resident set size (RSS) of each is reported after
+ * every round. Since the pools never return memory to the operating system,
+ * RSS staying flat says little on its own; so the benchmark fails if the pooled
+ * run's peak RSS exceeds the heap run's by more than the given tolerance. Each
+ * run's growth beyond its first round shows how much churn fragments the heap.
+ *
+ * Usage: pmdaqpid-churn [rounds [objects [tolerance-percent]]]
+ */
+
+#include "ObjectEntry.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+/// Number of statistics slots per record, as for a fully-exported queue.
+const size_t statisticsSlots = 44;
+
+/// Resident memory used by one benchmark run.
+struct Usage {
+    unsigned long firstKilobytes; ///< RSS after the first round.
+    unsigned long maxKilobytes;   ///< Maximum RSS after any round.
+};
+
+/**
+ * @brief Create a snapshot, either pooled or from the general heap.
+ *
+ * @param pooled \c true to use ObjectEntry's pooled factory.
+ * @param name   Snapshot name.
+ * @param slots  Snapshot values.
+ *
+ * @return A new snapshot.
+ */
+ObjectEntry::Snapshot createSnapshot(const bool pooled, const std::string &name,
+                                     const std::vector<ObjectRecord::Slot> &slots)
+{
+    return pooled ? ObjectEntry::createSnapshot(ConsoleUtils::Queue, name, slots)
+                  : boost::make_shared<ObjectRecord>(ConsoleUtils::Queue, name, slots);
+}
+
+/**
+ * @brief Create a snapshot resembling a queue's properties.
+ *
+ * @param pooled \c true to use ObjectEntry's pooled factory.
+ * @param name   Queue name.
+ *
+ * @return A new snapshot.
+ */
+ObjectEntry::Snapshot createProps(const bool pooled, const std::string &name)
+{
+    ObjectRecord::Slot slot;
+    slot.status = 0;
+    slot.type = PM_TYPE_STRING;
+    slot.atom.cp = NULL;
+    slot.string = name + ".arguments";
+    return createSnapshot(pooled, name, std::vector<ObjectRecord::Slot>(2, slot));
+}
+
+/**
+ * @brief Create a snapshot resembling a queue's statistics.
+ *
+ * @param pooled \c true to use ObjectEntry's pooled factory.
+ * @param name   Queue name.
+ * @param value  Value for all of the snapshot's numeric slots.
+ *
+ * @return A new snapshot.
+ */
+ObjectEntry::Snapshot createStats(const bool pooled, const std::string &name,
+                                  const uint64_t value)
+{
+    ObjectRecord::Slot slot;
+    slot.status = 0;
+    slot.type = PM_TYPE_U64;
+    slot.atom.ull = value;
+    return createSnapshot(pooled, name, std::vector<ObjectRecord::Slot>(statisticsSlots, slot));
+}
+
+/**
+ * @brief Get this process's current resident set size.
+ *
+ * @return Resident set size, in kilobytes, or 0 if it could not be read.
+ */
+unsigned long getResidentKilobytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    unsigned long size = 0, resident = 0;
+    statm >> size >> resident;
+    return statm ? (resident * sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+/**
+ * @brief Run the churn benchmark with one allocation strategy.
+ *
+ * @param pooled  \c true to allocate via ObjectEntry's pooled factories.
+ * @param rounds  Number of rounds to run.
+ * @param objects Number of live objects.
+ *
+ * @return The resident memory used.
+ */
+Usage churn(const bool pooled, const size_t rounds, const size_t objects)
+{
+    const char * const label = pooled ? "pooled" : "heap";
+    boost::random::mt19937 random;
+    boost::random::uniform_int_distribution<size_t> nameLength(8, 120);
+    boost::random::uniform_int_distribution<size_t> pick(0, objects - 1);
+    std::vector<ObjectEntry::Ptr> live(objects);
+    uint64_t created = 0;
+    Usage usage = { 0, 0 };
+
+    for (size_t round = 0; round < rounds; ++round) {
+        // Replace (at least) half of the live objects, as short-lived queues do.
+        const size_t replacements = (round == 0) ? objects : (objects + 1) / 2;
+        for (size_t count = 0; count < replacements; ++count) {
+            ObjectEntry::Ptr &entry = live[(round == 0) ? count : pick(random)];
+            entry.reset(); // Delete the old object before creating its replacement.
+            const std::string name = "tmp." + boost::lexical_cast<std::string>(++created)
+                                   + std::string(nameLength(random), 'x');
+            entry = pooled ? ObjectEntry::create(qpid::console::ObjectId())
+                           : boost::make_shared<ObjectEntry>(qpid::console::ObjectId());
+            entry->setProps(createProps(pooled, name));
+            entry->setStats(createStats(pooled, name, created));
+        }
+
+        const unsigned long kilobytes = getResidentKilobytes();
+        printf("%s round %ju: %ju objects created, RSS %lu kB\n", label,
+               (uintmax_t)(round + 1), (uintmax_t)created, kilobytes);
+        if (round == 0) {
+            usage.firstKilobytes = kilobytes; // The first round sets the live working set.
+        }
+        usage.maxKilobytes = std::max(usage.maxKilobytes, kilobytes);
+    }
+    return usage;
+}
+
+/**
+ * @brief Run the churn benchmark in a child process, so that each allocation
+ *        strategy starts from a fresh heap.
+ *
+ * @param pooled  \c true to allocate via ObjectEntry's pooled factories.
+ * @param rounds  Number of rounds to run.
+ * @param objects Number of live objects.
+ * @param usage   Set to the resident memory used by the child.
+ *
+ * @return \c true on success, else \c false.
+ */
+bool churnInChild(const bool pooled, const size_t rounds, const size_t objects, Usage &usage)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        const Usage result = churn(pooled, rounds, objects);
+        fflush(stdout);
+        const bool written = (write(fds[1], &result, sizeof(result)) == sizeof(result));
+        _exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(fds[1]);
+    const bool read = (::read(fds[0], &usage, sizeof(usage)) == sizeof(usage));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return ((read) && (WIFEXITED(status)) && (WEXITSTATUS(status) == EXIT_SUCCESS));
+}
+
+/**
+ * @brief Report one run's resident memory use.
+ *
+ * @param label Allocation strategy name.
+ * @param usage Resident memory used.
+ */
+void report(const char * const label, const Usage &usage)
+{
+    printf("%-6s RSS after first round %lu kB, maximum %lu kB, growth %lu kB\n", label,
+           usage.firstKilobytes, usage.maxKilobytes,
+           usage.maxKilobytes - std::min(usage.firstKilobytes, usage.maxKilobytes));
+}
+
+}
+
+/**
+ * @brief Object churn benchmark entry point.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ *
+ * @return EXIT_SUCCESS if the pooled run's peak RSS was within tolerance of
+ *         the heap run's, else EXIT_FAILURE.
+ */
+int main(int argc, char *argv[])
+{
+    size_t rounds = 100, objects = 20000, tolerance = 10;
+    try {
+        if (argc > 1) rounds    = boost::lexical_cast<size_t>(argv[1]);
+        if (argc > 2) objects   = boost::lexical_cast<size_t>(argv[2]);
+        if (argc > 3) tolerance = boost::lexical_cast<size_t>(argv[3]);
+    } catch (const boost::bad_lexical_cast &) {
+        fprintf(stderr, "usage: %s [rounds [objects [tolerance-percent]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ((rounds < 2) || (objects < 1)) {
+        fprintf(stderr, "at least 2 rounds, of at least 1 object, are required\n");
+        return EXIT_FAILURE;
+    }
+
+    Usage pooled, heap;
+    if ((!churnInChild(true, rounds, objects, pooled)) ||
+        (!churnInChild(false, rounds, objects, heap))) {
+        fprintf(stderr, "benchmark run failed\n");
+        return EXIT_FAILURE;
+    }
+    report("pooled", pooled);
+    report("heap", heap);
+
+    const unsigned long limit = heap.maxKilobytes + (heap.maxKilobytes * tolerance / 100);
+    printf("pooled maximum %lu kB, limit %lu kB: %s\n", pooled.maxKilobytes, limit,
+           (pooled.maxKilobytes <= limit) ? "ok" : "WORSE THAN HEAP");
+    return (pooled.maxKilobytes <= limit) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
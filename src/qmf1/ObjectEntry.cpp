@@ -0,0 +1,211 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Defines the ObjectEntry class.
+ */
+
+#include "ObjectEntry.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/ref.hpp>
+
+/**
+ * @brief Constructor.
+ *
+ * @param objectId ID of the QMF object this entry is for.
+ */
+ObjectEntry::ObjectEntry(const qpid::console::ObjectId &objectId)
+    : objectId(objectId), deleted(false), instanceId(NoInstance)
+{
+
+}
+
+/**
+ * @brief Create a new, pool-allocated, entry.
+ *
+ * @param objectId ID of the QMF object to create an entry for.
+ *
+ * @return A shared pointer to the new entry.
+ */
+ObjectEntry::Ptr ObjectEntry::create(const qpid::console::ObjectId &objectId)
+{
+    return boost::allocate_shared<ObjectEntry>(EntryAllocator(), objectId);
+}
+
+/**
+ * @brief Create a new, pool-allocated, snapshot of a QMF object.
+ *
+ * @param object     QMF object to decode.
+ * @param layout     Attributes to decode, indexed by PCP metric item.
+ * @param namePrefix Prefix for the snapshot's name.
+ *
+ * @return A shared pointer to the new snapshot.
+ *
+ * @see ObjectRecord::ObjectRecord
+ */
+ObjectEntry::Snapshot ObjectEntry::createSnapshot(const qpid::console::Object &object,
+                                                  const ObjectRecord::Layout &layout,
+                                                  const std::string &namePrefix)
+{
+    return boost::allocate_shared<ObjectRecord>(RecordAllocator(), object, layout, namePrefix);
+}
+
+/**
+ * @brief Create a new, pool-allocated, synthetic snapshot.
+ *
+ * @param type  QMF object type for the snapshot.
+ * @param name  Name for the snapshot.
+ * @param slots Values for the snapshot, if any, indexed by PCP metric item.
+ *
+ * @return A shared pointer to the new snapshot.
+ */
+ObjectEntry::Snapshot ObjectEntry::createSnapshot(const ConsoleUtils::ObjectSchemaType type,
+                                                  const std::string &name,
+                                                  const std::vector<ObjectRecord::Slot> &slots)
+{
+    return boost::allocate_shared<ObjectRecord>(RecordAllocator(), type, name, slots);
+}
+
+/**
+ * @brief Create a new, pool-allocated, snapshot summing two others.
+ *
+ * @param total  Snapshot to add to.
+ * @param addend Snapshot to add.
+ * @param layout Layout both snapshots were decoded with.
+ *
+ * @return A shared pointer to the new snapshot.
+ */
+ObjectEntry::Snapshot ObjectEntry::createSnapshot(const ObjectRecord &total,
+                                                  const ObjectRecord &addend,
+                                                  const ObjectRecord::Layout &layout)
+{
+    return boost::allocate_shared<ObjectRecord>(RecordAllocator(), total, addend, layout);
+}
+
+/**
+ * @brief Create a new, pool-allocated, snapshot read from a binary stream.
+ *
+ * @param stream Binary stream to read from.
+ *
+ * @return A shared pointer to the new snapshot.
+ *
+ * @see ObjectRecord::write
+ */
+ObjectEntry::Snapshot ObjectEntry::createSnapshot(std::istream &stream)
+{
+    return boost::allocate_shared<ObjectRecord>(RecordAllocator(), boost::ref(stream));
+}
+
+/**
+ * @brief Get the ID of the QMF object this entry is for.
+ *
+ * @return This entry's QMF object ID.
+ */
+const qpid::console::ObjectId &ObjectEntry::getObjectId() const
+{
+    return objectId;
+}
+
+/**
+ * @brief Get the latest properties snapshot.
+ *
+ * @return The latest properties snapshot, or a NULL pointer if none yet.
+ */
+ObjectEntry::Snapshot ObjectEntry::getProps() const
+{
+    return boost::atomic_load(&props);
+}
+
+/**
+ * @brief Get the latest statistics snapshot.
+ *
+ * @return The latest statistics snapshot, or a NULL pointer if none yet.
+ */
+ObjectEntry::Snapshot ObjectEntry::getStats() const
+{
+    return boost::atomic_load(&stats);
+}
+
+/**
+ * @brief Publish a new properties snapshot.
+ *
+ * @param snapshot New properties snapshot.
+ */
+void ObjectEntry::setProps(const Snapshot &snapshot)
+{
+    boost::atomic_store(&props, snapshot);
+}
+
+/**
+ * @brief Publish a new statistics snapshot.
+ *
+ * @param snapshot New statistics snapshot.
+ */
+void ObjectEntry::setStats(const Snapshot &snapshot)
+{
+    boost::atomic_store(&stats, snapshot);
+}
+
+/**
+ * @brief Has this entry's QMF object been deleted by the broker?
+ *
+ * @note This flag is only accessed by the ConsoleListener that owns this entry,
+ *       which protects it accordingly.
+ *
+ * @return \c true if this entry's object has been deleted.
+ */
+bool ObjectEntry::isDeleted() const
+{
+    return deleted;
+}
+
+/**
+ * @brief Mark this entry's QMF object as having been deleted by the broker.
+ *
+ * @see isDeleted
+ */
+void ObjectEntry::setDeleted()
+{
+    deleted = true;
+}
+
+/**
+ * @brief Get the PCP instance ID assigned to this entry.
+ *
+ * @note The instance ID is only accessed by the PMDA (that is, the thread that
+ *       fetches metrics), and so requires no additional protection.
+ *
+ * @return This entry's PCP instance ID, or one of the (negative) InstanceState
+ *         values if it currently has none.
+ */
+int ObjectEntry::getInstanceId() const
+{
+    return instanceId;
+}
+
+/**
+ * @brief Set the PCP instance ID assigned to this entry.
+ *
+ * @param id PCP instance ID, or one of the (negative) InstanceState values.
+ *
+ * @see getInstanceId
+ */
+void ObjectEntry::setInstanceId(const int id)
+{
+    instanceId = id;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Declares the ObjectEntry class.
+ */
+
+#ifndef __QPID_PMDA_OBJECT_ENTRY_H__
+#define __QPID_PMDA_OBJECT_ENTRY_H__
+
+#include "ObjectRecord.h"
+
+#include <boost/pool/pool_alloc.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * @brief Latest known snapshots of a single QMF object.
+ *
+ * Entries are shared between the ConsoleListener, which publishes new snapshots
+ * as QMF updates arrive, and the PMDA, which reads them while fetching. Both
+ * snapshots are swapped atomically, so neither side ever blocks the other.
+ *
+ * Entries and snapshots should be created via the create and createSnapshot
+ * factory functions, which allocate each one, along with its reference count,
+ * as a single chunk from a fixed-size memory pool. Since these are by far the
+ * most frequently allocated objects, and are freed as queues come and go, this
+ * halves the number of general heap allocations per object under queue churn.
+ *
+ * Note, however, that only these fixed-size headers are pooled - a record's
+ * slots, and any strings they render, are still allocated from the general
+ * heap. Also, the pools never return memory to the operating system; freed
+ * chunks are only reused by later entries and records, so the pools grow to
+ * the peak number of live objects, and stay there. The ObjectChurn benchmark
+ * compares resident memory under sustained churn with, and without, the pools.
+ */
+class ObjectEntry {
+
+public:
+    /// An immutable, reference-counted snapshot of a decoded QMF object.
+    typedef boost::shared_ptr<const ObjectRecord> Snapshot;
+
+    /// A shared pointer to an ObjectEntry.
+    typedef boost::shared_ptr<ObjectEntry> Ptr;
+
+    /// Special (negative) values for getInstanceId.
+    enum InstanceState {
+        NoInstance = -1,     ///< No PCP instance assigned yet.
+        DroppedInstance = -2 ///< Dropped; never to be assigned a PCP instance.
+    };
+
+    explicit ObjectEntry(const qpid::console::ObjectId &objectId);
+
+    static Ptr create(const qpid::console::ObjectId &objectId);
+
+    static Snapshot createSnapshot(const qpid::console::Object &object,
+                                   const ObjectRecord::Layout &layout,
+                                   const std::string &namePrefix = std::string());
+
+    static Snapshot createSnapshot(const ConsoleUtils::ObjectSchemaType type,
+                                   const std::string &name,
+                                   const std::vector<ObjectRecord::Slot> &slots =
+                                       std::vector<ObjectRecord::Slot>());
+
+    static Snapshot createSnapshot(const ObjectRecord &total, const ObjectRecord &addend,
+                                   const ObjectRecord::Layout &layout);
+
+    static Snapshot createSnapshot(std::istream &stream);
+
+    const qpid::console::ObjectId &getObjectId() const;
+
+    Snapshot getProps() const;
+
+    Snapshot getStats() const;
+
+    void setProps(const Snapshot &snapshot);
+
+    void setStats(const Snapshot &snapshot);
+
+    bool isDeleted() const;
+
+    void setDeleted();
+
+    int getInstanceId() const;
+
+    void setInstanceId(const int id);
+
+protected:
+    const qpid::console::ObjectId objectId; ///< QMF object ID.
+    Snapshot props; ///< Latest properties snapshot, if any.
+    Snapshot stats; ///< Latest statistics snapshot, if any.
+    bool deleted;   ///< Deleted by the broker? Owned by ConsoleListener.
+    int instanceId; ///< PCP instance ID, or InstanceState. Owned by the PMDA.
+
+    /// Pool allocator for ObjectEntry instances.
+    typedef boost::fast_pool_allocator<ObjectEntry> EntryAllocator;
+
+    /// Pool allocator for ObjectRecord instances.
+    typedef boost::fast_pool_allocator<ObjectRecord> RecordAllocator;
+
+};
+
+#endif
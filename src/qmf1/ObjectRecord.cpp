@@ -0,0 +1,432 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Defines the ObjectRecord class.
+ */
+
+#include "ObjectRecord.h"
+
+#include <pcp/impl.h>
+
+#include <istream>
+#include <ostream>
+
+namespace {
+
+/// Write a plain value to a binary stream.
+template <typename Type>
+void writeValue(std::ostream &stream, const Type &value)
+{
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+/// Write a length-prefixed string to a binary stream.
+void writeString(std::ostream &stream, const char * const value)
+{
+    const uint32_t length = strlen(value);
+    writeValue(stream, length);
+    stream.write(value, length);
+}
+
+/// Read a plain value from a binary stream.
+template <typename Type>
+Type readValue(std::istream &stream)
+{
+    Type value = Type();
+    stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+    return value;
+}
+
+/// Read a length-prefixed string from a binary stream.
+std::string readString(std::istream &stream)
+{
+    const uint32_t length = readValue<uint32_t>(stream);
+    if ((!stream) || (length > 65535)) {
+        stream.setstate(std::ios::failbit);
+        return std::string();
+    }
+    std::string value(length, '\0');
+    if (length > 0) {
+        stream.read(&value[0], length);
+    }
+    return value;
+}
+
+}
+
+
+/**
+ * @brief Decode a QMF object into a new record.
+ *
+ * @param object     QMF object to decode.
+ * @param layout     Attributes to decode, indexed by PCP metric item.
+ * @param namePrefix Prefix for the record's name (eg to qualify it by broker).
+ */
+ObjectRecord::ObjectRecord(const qpid::console::Object &object, const Layout &layout,
+                           const std::string &namePrefix)
+    : objectId(object.getObjectId()), type(ConsoleUtils::getType(object)),
+      name(namePrefix + ConsoleUtils::getName(object)), slots(layout.size())
+{
+    const qpid::console::Object::AttributeMap &attributes = object.getAttributes();
+    for (size_t item = 0; item < layout.size(); ++item) {
+        slots[item].status = PM_ERR_VALUE;
+        slots[item].type = layout[item].type;
+        if (layout[item].name.empty()) {
+            continue;
+        }
+        const qpid::console::Object::AttributeMap::const_iterator attribute =
+            attributes.find(layout[item].name);
+        if (attribute == attributes.end()) {
+            if (pmDebug & DBG_TRACE_APPL1) {
+                __pmNotifyErr(LOG_DEBUG, "no %s metric found for %s",
+                              layout[item].name.c_str(),
+                              ConsoleUtils::toString(object).c_str());
+            }
+            continue;
+        }
+        try {
+            slots[item] = decode(attribute->second, layout[item].type);
+        } catch (const qpid::Exception &ex) {
+            __pmNotifyErr(LOG_ERR, "error converting %s metric to type %d: %s",
+                          layout[item].name.c_str(), layout[item].type, ex.what());
+            slots[item].status = PM_ERR_TYPE;
+        }
+    }
+}
+
+/**
+ * @brief Construct a synthetic record.
+ *
+ * By default, the new record has no slots, so all of its metric values are
+ * unavailable.
+ *
+ * @param type  QMF object type for the record.
+ * @param name  Name for the record.
+ * @param slots Values for the record, indexed by PCP metric item.
+ */
+ObjectRecord::ObjectRecord(const ConsoleUtils::ObjectSchemaType type, const std::string &name,
+                           const std::vector<Slot> &slots)
+    : type(type), name(name), slots(slots)
+{
+
+}
+
+/**
+ * @brief Construct a synthetic record by adding one record's counters to another.
+ *
+ * Counters (ie numeric items with PM_SEM_COUNTER semantics) available in both
+ * records are summed. Counters available in only one record are taken from that
+ * record. All other values are unavailable in the new record, since values such
+ * as queue depths, high and low water marks, and latencies either cannot be
+ * summed meaningfully, or describe objects no longer being updated, and so
+ * would only be frozen at stale values.
+ *
+ * The new record takes its object ID, type and name from \a total.
+ *
+ * @param total  Record to add to.
+ * @param addend Record to add.
+ * @param layout Layout both records were decoded with.
+ */
+ObjectRecord::ObjectRecord(const ObjectRecord &total, const ObjectRecord &addend,
+                           const Layout &layout)
+    : objectId(total.objectId), type(total.type), name(total.name), slots(total.slots)
+{
+    Slot empty;
+    empty.status = PM_ERR_VALUE;
+    empty.type = PM_TYPE_UNKNOWN;
+    if (slots.size() < addend.slots.size()) {
+        slots.resize(addend.slots.size(), empty);
+    }
+    for (size_t item = 0; item < slots.size(); ++item) {
+        Slot &to = slots[item];
+        if ((item >= layout.size()) || (layout[item].semantics != PM_SEM_COUNTER) ||
+            (layout[item].type == PM_TYPE_STRING)) {
+            to = empty;
+            continue;
+        }
+        if ((item >= addend.slots.size()) || (addend.slots[item].status != 0)) {
+            continue;
+        }
+        const Slot &from = addend.slots[item];
+        if (to.status != 0) {
+            to = from;
+            continue;
+        }
+        addAtom(to.atom, from.atom, layout[item].type);
+    }
+}
+
+/**
+ * @brief Read a record previously written by write.
+ *
+ * Records read this way have a default (null) object ID, since QMF object IDs
+ * are not meaningful beyond the lifetime of the broker session they came from.
+ *
+ * @param stream Binary stream to read from. If the record cannot be read, the
+ *               stream's failbit will be set.
+ *
+ * @see write
+ */
+ObjectRecord::ObjectRecord(std::istream &stream)
+    : type(static_cast<ConsoleUtils::ObjectSchemaType>(readValue<uint8_t>(stream))),
+      name(readString(stream))
+{
+    const uint32_t count = readValue<uint32_t>(stream);
+    if ((!stream) || (type > ConsoleUtils::Other) || (count > 1024)) {
+        stream.setstate(std::ios::failbit);
+        return;
+    }
+    slots.resize(count);
+    for (std::vector<Slot>::iterator slot = slots.begin(); (stream) && (slot != slots.end()); ++slot) {
+        slot->status = readValue<int32_t>(stream);
+        slot->type = readValue<int32_t>(stream);
+        slot->atom.ull = 0;
+        if (slot->status != 0) {
+            continue;
+        }
+        if (slot->type == PM_TYPE_STRING) {
+            slot->atom.cp = NULL;
+            slot->string = readString(stream);
+        } else {
+            slot->atom = readValue<pmAtomValue>(stream);
+        }
+    }
+}
+
+/**
+ * @brief Does this record match a layout?
+ *
+ * Records decoded via the given layout always match it, but records read from
+ * a stream (see ObjectRecord(std::istream &)) may have been written by another
+ * build, or with other metrics selected, or may be corrupt. Such records must
+ * not be used with \a layout, since (for example) a numeric value in a string
+ * metric's slot would be rendered as a string.
+ *
+ * @param layout Layout to check against.
+ *
+ * @return \c true if this record has no more slots than \a layout, and every
+ *         available value is of its layout's type, else \c false.
+ */
+bool ObjectRecord::matches(const Layout &layout) const
+{
+    if (slots.size() > layout.size()) {
+        return false;
+    }
+    for (size_t item = 0; item < slots.size(); ++item) {
+        if ((slots[item].status > 0) ||
+            ((slots[item].status == 0) && (slots[item].type != layout[item].type))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Write this record to a binary stream.
+ *
+ * The format is compact, but host-specific (ie native byte order and sizes),
+ * since it is only intended to be read back by the same host.
+ *
+ * @param stream Binary stream to write to.
+ *
+ * @see ObjectRecord(std::istream &)
+ */
+void ObjectRecord::write(std::ostream &stream) const
+{
+    writeValue(stream, static_cast<uint8_t>(type));
+    writeString(stream, name.c_str());
+    writeValue(stream, static_cast<uint32_t>(slots.size()));
+    for (std::vector<Slot>::const_iterator slot = slots.begin(); slot != slots.end(); ++slot) {
+        writeValue(stream, static_cast<int32_t>(slot->status));
+        writeValue(stream, static_cast<int32_t>(slot->type));
+        if (slot->status != 0) {
+            continue;
+        }
+        if (slot->type == PM_TYPE_STRING) {
+            writeString(stream, getString(*slot));
+        } else {
+            writeValue(stream, slot->atom);
+        }
+    }
+}
+
+/**
+ * @brief Get the ID of the QMF object this record was decoded from.
+ *
+ * @return This record's QMF object ID.
+ */
+const qpid::console::ObjectId &ObjectRecord::getObjectId() const
+{
+    return objectId;
+}
+
+/**
+ * @brief Get the type of the QMF object this record was decoded from.
+ *
+ * @return One of the ConsoleUtils::ObjectSchemaType enumeration values.
+ */
+ConsoleUtils::ObjectSchemaType ObjectRecord::getType() const
+{
+    return type;
+}
+
+/**
+ * @brief Get the name of the QMF object this record was decoded from.
+ *
+ * @return This record's object name (including any prefix the record was
+ *         decoded with), or an empty string if it has none.
+ *
+ * @see ConsoleUtils::getName
+ */
+const std::string &ObjectRecord::getName() const
+{
+    return name;
+}
+
+/**
+ * @brief Get a decoded metric value.
+ *
+ * @param item PCP metric item to get the value of.
+ *
+ * @return The decoded value, or \c NULL if \a item was not in this record's
+ *         layout.
+ */
+const ObjectRecord::Slot * ObjectRecord::getSlot(const size_t item) const
+{
+    return (item < slots.size()) ? &slots[item] : NULL;
+}
+
+/**
+ * @brief Get a slot's string value.
+ *
+ * The returned pointer remains valid for as long as the record containing
+ * \a slot does.
+ *
+ * @param slot Decoded slot of type PM_TYPE_STRING.
+ *
+ * @return The slot's rendered string value.
+ */
+const char * ObjectRecord::getString(const Slot &slot)
+{
+    return (slot.atom.cp == NULL) ? slot.string.c_str() : slot.atom.cp;
+}
+
+/**
+ * @brief Add (or subtract) this record's numeric values to (or from) totals.
+ *
+ * Only numeric values available in this record are added; strings, and
+ * unavailable values, are skipped. Since subtracting a record exactly undoes
+ * adding it, callers can maintain running totals across many records by
+ * subtracting each record's previous values as its new values are added.
+ *
+ * @param totals   Totals, indexed by PCP metric item, typed per \a layout.
+ *                 Grown to \a layout's size, if necessary.
+ * @param layout   Layout this record was decoded with.
+ * @param subtract \c true to subtract this record's values, instead of adding.
+ * @param counters \c false to skip counter (ie PM_SEM_COUNTER) values.
+ */
+void ObjectRecord::addTo(std::vector<pmAtomValue> &totals, const Layout &layout,
+                         const bool subtract, const bool counters) const
+{
+    if (totals.size() < layout.size()) {
+        pmAtomValue zero;
+        zero.ull = 0;
+        totals.resize(layout.size(), zero);
+    }
+    for (size_t item = 0; (item < slots.size()) && (item < layout.size()); ++item) {
+        if ((slots[item].status == 0) && (layout[item].type != PM_TYPE_STRING) &&
+            ((counters) || (layout[item].semantics != PM_SEM_COUNTER))) {
+            addAtom(totals[item], slots[item].atom, layout[item].type, subtract);
+        }
+    }
+}
+
+/**
+ * @brief Add (or subtract) one numeric PCP atom to (or from) another.
+ *
+ * Integer arithmetic wraps, so a running total maintained by adding and then
+ * later subtracting the same values is always exact.
+ *
+ * @param total    Atom to add to.
+ * @param addend   Atom to add.
+ * @param type     PCP type of both atoms. Non-numeric types are ignored.
+ * @param subtract \c true to subtract \a addend, instead of adding.
+ */
+void ObjectRecord::addAtom(pmAtomValue &total, const pmAtomValue &addend, const int type,
+                           const bool subtract)
+{
+    switch (type) {
+        case PM_TYPE_32:
+            total.l = static_cast<int32_t>(subtract
+                ? static_cast<uint32_t>(total.l) - static_cast<uint32_t>(addend.l)
+                : static_cast<uint32_t>(total.l) + static_cast<uint32_t>(addend.l));
+            break;
+        case PM_TYPE_64:
+            total.ll = static_cast<int64_t>(subtract
+                ? static_cast<uint64_t>(total.ll) - static_cast<uint64_t>(addend.ll)
+                : static_cast<uint64_t>(total.ll) + static_cast<uint64_t>(addend.ll));
+            break;
+        case PM_TYPE_U32:    total.ul  = subtract ? total.ul  - addend.ul  : total.ul  + addend.ul;  break;
+        case PM_TYPE_U64:    total.ull = subtract ? total.ull - addend.ull : total.ull + addend.ull; break;
+        case PM_TYPE_FLOAT:  total.f   = subtract ? total.f   - addend.f   : total.f   + addend.f;   break;
+        case PM_TYPE_DOUBLE: total.d   = subtract ? total.d   - addend.d   : total.d   + addend.d;   break;
+    }
+}
+
+/**
+ * @brief Decode a single QMF value.
+ *
+ * String-typed values are rendered here, once per record, so that repeated
+ * fetches do no formatting nor allocation. Boolean and null values, which are
+ * very common (eg autoDelete and durable properties), reference static strings
+ * instead of allocating their own.
+ *
+ * @param value QMF value to decode.
+ * @param type  PCP metric type to decode \a value as.
+ *
+ * @throw qpid::Exception if \a value cannot be converted to \a type.
+ *
+ * @return The decoded value.
+ */
+ObjectRecord::Slot ObjectRecord::decode(const qpid::console::Value::Ptr &value, const int type)
+{
+    Slot slot;
+    slot.status = 0;
+    slot.type = type;
+    switch (type) {
+        case PM_TYPE_32:     slot.atom.l   = value->asInt();    break;
+        case PM_TYPE_64:     slot.atom.ll  = value->asInt64();  break;
+        case PM_TYPE_U32:    slot.atom.ul  = value->asUint();   break;
+        case PM_TYPE_U64:    slot.atom.ull = value->asUint64(); break;
+        case PM_TYPE_FLOAT:  slot.atom.f   = value->asFloat();  break;
+        case PM_TYPE_DOUBLE: slot.atom.d   = value->asDouble(); break;
+        case PM_TYPE_STRING:
+            if (value->isBool()) {
+                slot.atom.cp = const_cast<char *>(value->asBool() ? "true" : "false");
+            } else if (value->isNull()) {
+                slot.atom.cp = const_cast<char *>("null");
+            } else {
+                slot.atom.cp = NULL;
+                slot.string = ConsoleUtils::toString(*value);
+            }
+            break;
+        default:
+            slot.status = PM_ERR_TYPE;
+    }
+    return slot;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Declares the ObjectRecord class.
+ */
+
+#ifndef __QPID_PMDA_OBJECT_RECORD_H__
+#define __QPID_PMDA_OBJECT_RECORD_H__
+
+#include "ConsoleUtils.h"
+
+#include <pcp/pmapi.h>
+
+#include <iosfwd>
+#include <vector>
+
+/**
+ * @brief Pre-decoded metric values for a single QMF object.
+ *
+ * This class decodes a QMF object's attributes, once, into a compact record
+ * with one typed slot per PCP metric item, so that fetching a metric value is
+ * a simple indexed load, rather than an attribute name lookup and type
+ * conversion.
+ *
+ * Records are never modified once constructed.
+ */
+class ObjectRecord {
+
+public:
+    /// Describes the QMF attribute, and PCP type, to decode for a metric item.
+    struct Attribute {
+        std::string name; ///< QMF attribute name, or empty to skip this item.
+        int type;         ///< PCP metric type to decode the attribute as.
+        int semantics;    ///< PCP metric semantics, eg PM_SEM_COUNTER.
+    };
+
+    /// Attributes to decode, indexed by PCP metric item.
+    typedef std::vector<Attribute> Layout;
+
+    /// A single decoded metric value.
+    struct Slot {
+        int status;         ///< 0 on success, else a PCP error code.
+        int type;           ///< PCP metric type the value was decoded as.
+        pmAtomValue atom;   ///< Decoded value, if status is 0.
+        std::string string; ///< Rendered string value, if atom.cp is \c NULL.
+    };
+
+    ObjectRecord(const qpid::console::Object &object, const Layout &layout,
+                 const std::string &namePrefix = std::string());
+
+    ObjectRecord(const ConsoleUtils::ObjectSchemaType type, const std::string &name,
+                 const std::vector<Slot> &slots = std::vector<Slot>());
+
+    ObjectRecord(const ObjectRecord &total, const ObjectRecord &addend, const Layout &layout);
+
+    explicit ObjectRecord(std::istream &stream);
+
+    bool matches(const Layout &layout) const;
+
+    void write(std::ostream &stream) const;
+
+    const qpid::console::ObjectId &getObjectId() const;
+
+    ConsoleUtils::ObjectSchemaType getType() const;
+
+    const std::string &getName() const;
+
+    const Slot * getSlot(const size_t item) const;
+
+    static const char * getString(const Slot &slot);
+
+    void addTo(std::vector<pmAtomValue> &totals, const Layout &layout,
+               const bool subtract = false, const bool counters = true) const;
+
+    static void addAtom(pmAtomValue &total, const pmAtomValue &addend, const int type,
+                        const bool subtract = false);
+
+protected:
+    qpid::console::ObjectId objectId;    ///< QMF object ID.
+    ConsoleUtils::ObjectSchemaType type; ///< QMF object type.
+    std::string name;                    ///< QMF object name.
+    std::vector<Slot> slots;             ///< Decoded values, indexed by item.
+
+    static Slot decode(const qpid::console::Value::Ptr &value, const int type);
+
+};
+
+#endif
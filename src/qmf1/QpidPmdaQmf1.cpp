@@ -29,17 +29,108 @@
 #include <qpid/Url.h>
 
 #include "ConsoleUtils.h"
+#include "Histogram.h"
+
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <sstream>
+
+namespace {
+
+/// Percentiles exported for histogrammed metrics, indexed by percentile instance ID.
+const unsigned int percentiles[] = { 50, 90, 99 };
+
+/// Is a queue statistic histogrammed (see QpidPmdaQmf1::fetchHistogramValue)?
+bool isHistogrammed(const std::string &name)
+{
+    return ((name == "consumerCount") || (name == "messageLatencyAverage") || (name == "msgDepth"));
+}
+
+/// Does a string end with a given suffix?
+bool endsWith(const std::string &string, const std::string &suffix)
+{
+    return ((string.size() >= suffix.size()) &&
+            (string.compare(string.size() - suffix.size(), suffix.size(), suffix) == 0));
+}
+
+/// Is a queue statistic meaningful as a total across queues (see QpidPmdaQmf1::fetchAggregateValue)?
+bool isAggregated(const pcp::metric_description &description)
+{
+    // Counters and current levels add up across queues; watermarks and latencies do not.
+    const std::string &name = description.metric_name;
+    return ((description.type != PM_TYPE_STRING) &&
+            ((description.semantic == PM_SEM_COUNTER) ||
+             ((description.semantic == PM_SEM_INSTANT) && (name.compare(0, 14, "messageLatency") != 0) &&
+              (!endsWith(name, "High")) && (!endsWith(name, "Low")))));
+}
+
+/// Maximum seconds a fetch waits for stale brokers to refresh; below pmcd's default timeout.
+const unsigned int maxRefreshWait = 4;
+
+}
 
 /**
  * @brief Default constructor.
  */
-QpidPmdaQmf1::QpidPmdaQmf1() : nonPmdaMode(false), sessionManager(&consoleListener)
+QpidPmdaQmf1::QpidPmdaQmf1()
+    : nonPmdaMode(false), passiveMode(false), maxStaleness(0), queryTimeout(2),
+      stateInterval(60), lastStateSaveTime(0), staleGracePeriod(60),
+      staleExpiryTime(0), staleCount(0), fetchGeneration(0)
 {
+    std::fill(indomGenerations, indomGenerations + ConsoleUtils::Other, 0);
+
     // Setup our instance domain IDs.  Thses instance domains are empty to
     // begin with - we'll dynamically add to them as Qpid updates arrive.
     broker_domain(0);
     queue_domain(1);
     system_domain(2);
+    connection_domain(3);
+    aggregate_domain(4);
+    histogram_domain(5);
+    percentile_domain(6);
+}
+
+/**
+ * @brief Destructor.
+ */
+QpidPmdaQmf1::~QpidPmdaQmf1()
+{
+    for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator iter = brokerSessions.begin();
+         iter != brokerSessions.end(); ++iter)
+    {
+        if (!(*iter)->stop()) {
+            // The session's thread is still blocked connecting, so deliberately
+            // leak the session, rather than destroy it out from under the thread.
+            new boost::shared_ptr<BrokerSession>(*iter);
+        }
+    }
+    stateFile.stop();
+}
+
+/**
+ * @brief Get the QMF session settings to use.
+ *
+ * By default, a QMF session subscribes to every QMF class, along with all QMF
+ * events and agent heartbeats, most of which this PMDA would just discard.
+ * So here we enable user bindings instead, so that initialize_pmda can bind
+ * to just those classes this PMDA actually exports, and disable events and
+ * heartbeats, which this PMDA does not use at all.
+ *
+ * In passive mode, unsolicited object updates are disabled too, so that all
+ * updates come from the getObjects queries made by BrokerSession::refreshObjects.
+ *
+ * @return QMF session settings.
+ */
+qpid::console::SessionManager::Settings QpidPmdaQmf1::getSessionSettings() const
+{
+    qpid::console::SessionManager::Settings settings;
+    settings.rcvObjects = !passiveMode;
+    settings.rcvEvents = false;
+    settings.rcvHeartbeats = false;
+    settings.userBindings = true;
+    settings.getTimeout = queryTimeout;
+    return settings;
 }
 
 /**
@@ -106,7 +197,11 @@ boost::program_options::options_description QpidPmdaQmf1::get_supported_options(
         ("locale", value<double>(), "locale to use for Qpid connections")
         ("protocol", value<std::string>(), "version of AMQP to use (e.g. amqp0-10 or amqp1.0)")
         ("tcp-nodelay", bool_switch(), "whether nagle should be enabled")
-        ("transport", value<std::string>(), "underlying transport to use (e.g. tcp, ssl, rdma)");
+        ("transport", value<std::string>(), "underlying transport to use (e.g. tcp, ssl, rdma)")
+        ("reconnect-delay", value<unsigned int>()->default_value(1)
+         PCP_CPP_BOOST_PO_VALUE_NAME("seconds"), "initial maximum delay before re-priming a reconnected broker")
+        ("reconnect-max-delay", value<unsigned int>()->default_value(60)
+         PCP_CPP_BOOST_PO_VALUE_NAME("seconds"), "maximum delay before re-priming a reconnected broker");
     options_description authenticationOptions("Broker authentication options");
     authenticationOptions.add_options()
         ("username", value<std::string>(), "username to authenticate as")
@@ -117,10 +212,54 @@ boost::program_options::options_description QpidPmdaQmf1::get_supported_options(
         ("sasl-service", value<std::string>(), "service name, if needed by SASL mechanism");
     options_description queueOptions("Queue options");
     queueOptions.add_options()
-        ("include-auto-delete", bool_switch(), "include auto-delete queues");
+        ("include-auto-delete", bool_switch(), "include auto-delete queues")
+        ("queue-include", value<string_vector>()
+         PCP_CPP_BOOST_PO_VALUE_NAME("glob"), "only include queues matching glob(s)")
+        ("queue-exclude", value<string_vector>()
+         PCP_CPP_BOOST_PO_VALUE_NAME("glob"), "exclude queues matching glob(s)")
+        ("delete-grace", value<unsigned int>()->default_value(60)
+         PCP_CPP_BOOST_PO_VALUE_NAME("seconds"), "time to keep reporting deleted objects");
+    options_description metricOptions("Metric options");
+    metricOptions.add_options()
+        ("include-metrics", value<string_vector>()
+         PCP_CPP_BOOST_PO_VALUE_NAME("glob"), "only export metrics matching glob(s) (e.g. queue.*)")
+        ("exclude-metrics", value<string_vector>()
+         PCP_CPP_BOOST_PO_VALUE_NAME("glob"), "do not export metrics matching glob(s)");
+    options_description refreshOptions("Refresh options");
+    refreshOptions.add_options()
+        ("max-staleness", value<unsigned int>()->default_value(0)
+         PCP_CPP_BOOST_PO_VALUE_NAME("seconds"), "query brokers on fetch if data is older (0 to never)")
+        ("passive", bool_switch(), "disable broker updates; query brokers on fetch only")
+        ("query-timeout", value<unsigned int>()->default_value(2)
+         PCP_CPP_BOOST_PO_VALUE_NAME("seconds"), "timeout for broker queries");
+    options_description stateOptions("State options");
+    stateOptions.add_options()
+        ("state-file", value<std::string>()->default_value(
+            std::string(pmGetConfig("PCP_VAR_DIR")) + "/config/pmda/qpid.state")
+         PCP_CPP_BOOST_PO_VALUE_NAME("file"), "file to save last known values to, for warm restarts")
+        ("state-interval", value<unsigned int>()->default_value(60)
+         PCP_CPP_BOOST_PO_VALUE_NAME("seconds"), "time between state file saves (0 to disable)");
+    options_description performanceOptions("Performance options");
+    performanceOptions.add_options()
+        ("max-pending-updates", value<unsigned int>()->default_value(65536)
+         PCP_CPP_BOOST_PO_VALUE_NAME("objects"), "maximum objects with buffered QMF updates, per broker")
+        ("update-threads", value<unsigned int>()->default_value(1)
+         PCP_CPP_BOOST_PO_VALUE_NAME("count"), "number of threads decoding QMF updates, per broker")
+        ("max-brokers", value<unsigned int>()->default_value(0)
+         PCP_CPP_BOOST_PO_VALUE_NAME("count"), "maximum broker instances per broker (0 for no limit)")
+        ("max-queues", value<unsigned int>()->default_value(0)
+         PCP_CPP_BOOST_PO_VALUE_NAME("count"), "maximum queue instances per broker (0 for no limit)")
+        ("max-systems", value<unsigned int>()->default_value(0)
+         PCP_CPP_BOOST_PO_VALUE_NAME("count"), "maximum system instances per broker (0 for no limit)")
+        ("max-evicted", value<unsigned int>()->default_value(65536)
+         PCP_CPP_BOOST_PO_VALUE_NAME("count"), "maximum evicted objects to ignore until deleted, per broker");
     return connectionOptions
             .add(authenticationOptions)
             .add(queueOptions)
+            .add(metricOptions)
+            .add(refreshOptions)
+            .add(stateOptions)
+            .add(performanceOptions)
             .add(pcp::pmda::get_supported_options());
 }
 
@@ -243,9 +382,79 @@ bool QpidPmdaQmf1::parse_command_line(const int argc, const char * const argv[],
         }
     }
 
-    consoleListener.setIncludeAutoDelete(
-        (options.count("include-auto-delete")) && (options["include-auto-delete"].as<bool>())
-    );
+    // Create an independent QMF session (and listener) for each broker.
+    brokerSessions.clear();
+    for (std::vector<qpid::client::ConnectionSettings>::const_iterator iter = qpidConnectionSettings.begin();
+         iter != qpidConnectionSettings.end(); ++iter)
+    {
+        brokerSessions.push_back(boost::shared_ptr<BrokerSession>(new BrokerSession(*iter)));
+    }
+
+    // Configure each broker session, and its QMF console listener.
+    for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = brokerSessions.begin();
+         session != brokerSessions.end(); ++session)
+    {
+        ConsoleListener &listener = (*session)->getListener();
+        if (brokerSessions.size() > 1) {
+            // Qualify instance names by broker, since objects of the same name
+            // (eg HA replicated queues) commonly exist on several brokers.
+            listener.setNamePrefix((*session)->getName() + '/');
+        }
+        listener.setIncludeAutoDelete(
+            (options.count("include-auto-delete")) && (options["include-auto-delete"].as<bool>())
+        );
+        listener.setQueueFilters(
+            options.count("queue-include") ? options["queue-include"].as<string_vector>() : string_vector(),
+            options.count("queue-exclude") ? options["queue-exclude"].as<string_vector>() : string_vector()
+        );
+        if (options.count("delete-grace")) {
+            listener.setDeleteGracePeriod(options["delete-grace"].as<unsigned int>());
+        }
+        if (options.count("max-pending-updates")) {
+            listener.setMaxPendingUpdates(options["max-pending-updates"].as<unsigned int>());
+        }
+        if (options.count("update-threads")) {
+            listener.setUpdateThreads(options["update-threads"].as<unsigned int>());
+        }
+        if ((options.count("reconnect-delay")) && (options.count("reconnect-max-delay"))) {
+            (*session)->setReconnectDelays(options["reconnect-delay"].as<unsigned int>(),
+                                           options["reconnect-max-delay"].as<unsigned int>());
+        }
+        #define SET_MAX_OBJECTS(type, key) \
+            if (options.count(key)) { \
+                listener.setMaxObjects(type, options[key].as<unsigned int>()); \
+            }
+        SET_MAX_OBJECTS(ConsoleUtils::Broker, "max-brokers")
+        SET_MAX_OBJECTS(ConsoleUtils::Queue,  "max-queues")
+        SET_MAX_OBJECTS(ConsoleUtils::System, "max-systems")
+        #undef SET_MAX_OBJECTS
+        if (options.count("max-evicted")) {
+            listener.setMaxEvictedObjects(options["max-evicted"].as<unsigned int>());
+        }
+    }
+
+    if (options.count("include-metrics")) {
+        metricIncludes = options["include-metrics"].as<string_vector>();
+    }
+    if (options.count("exclude-metrics")) {
+        metricExcludes = options["exclude-metrics"].as<string_vector>();
+    }
+    passiveMode = ((options.count("passive") > 0) && (options["passive"].as<bool>()));
+    if (options.count("max-staleness")) {
+        maxStaleness = options["max-staleness"].as<unsigned int>();
+    }
+    if (options.count("query-timeout")) {
+        queryTimeout = options["query-timeout"].as<unsigned int>();
+    }
+    if (options.count("delete-grace")) {
+        staleGracePeriod = options["delete-grace"].as<unsigned int>();
+    }
+    if (options.count("state-file")) {
+        stateFile.setFileName(options["state-file"].as<std::string>());
+    }
+    if (options.count("state-interval")) {
+        stateInterval = options["state-interval"].as<unsigned int>();
+    }
 
     nonPmdaMode = ((options.count("no-pmda") > 0) && (options["no-pmda"].as<bool>()));
     return true;
@@ -258,13 +467,95 @@ bool QpidPmdaQmf1::parse_command_line(const int argc, const char * const argv[],
  */
 void QpidPmdaQmf1::initialize_pmda(pmdaInterface &interface)
 {
-    // Setup the QMF console listener.
-    for (std::vector<qpid::client::ConnectionSettings>::const_iterator iter = qpidConnectionSettings.begin();
-         iter != qpidConnectionSettings.end(); ++iter)
+    // Tell the QMF console listeners which attributes to decode for each metric,
+    // including the queue statistics behind any aggregate, histogram or
+    // percentile metrics, whether or not those queue metrics are selected too.
+    bool exported[ConsoleUtils::Other] = { false };
+    const pcp::metrics_description metrics = get_supported_metrics();
+    const pcp::metrics_description allMetrics = getAllMetrics();
+    pcp::metrics_description decoded(metrics);
+    for (pcp::metrics_description::const_iterator cluster = metrics.lower_bound(8);
+         cluster != metrics.upper_bound(10); ++cluster)
     {
-        // Local variable needed because addBroker takes a non-const argument.
-        qpid::client::ConnectionSettings connectionSettings(*iter);
-        sessionManager.addBroker(connectionSettings);
+        for (pcp::metric_cluster::const_iterator item = cluster->second.begin();
+             item != cluster->second.end(); ++item)
+        {
+            decoded[3].insert(*allMetrics.find(3)->second.find(item->first));
+        }
+    }
+    for (pcp::metrics_description::const_iterator cluster = decoded.begin();
+         cluster != decoded.end(); ++cluster)
+    {
+        const ConsoleUtils::ObjectSchemaType type =
+            static_cast<ConsoleUtils::ObjectSchemaType>(cluster->first / 2);
+        if (type >= ConsoleUtils::Other) {
+            continue; // Not a QMF object cluster.
+        }
+        ObjectRecord::Layout layout;
+        for (pcp::metric_cluster::const_iterator item = cluster->second.begin();
+             item != cluster->second.end(); ++item)
+        {
+            if (item->first >= layout.size()) {
+                layout.resize(item->first + 1);
+            }
+            layout[item->first].name = item->second.metric_name;
+            layout[item->first].type = item->second.type;
+            layout[item->first].semantics = item->second.semantic;
+        }
+        for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = brokerSessions.begin();
+             session != brokerSessions.end(); ++session)
+        {
+            (*session)->getListener().setLayout(type, (cluster->first % 2 != 0), layout);
+        }
+        layouts[type][cluster->first % 2] = layout;
+        exported[type] = true;
+    }
+
+    // Histogram the queue statistics behind any histogram or percentile metrics.
+    std::set<size_t> histogramItems;
+    for (pcp::metrics_description::const_iterator cluster = metrics.lower_bound(9);
+         cluster != metrics.upper_bound(10); ++cluster)
+    {
+        for (pcp::metric_cluster::const_iterator item = cluster->second.begin();
+             item != cluster->second.end(); ++item)
+        {
+            histogramItems.insert(item->first);
+        }
+    }
+    for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = brokerSessions.begin();
+         session != brokerSessions.end(); ++session)
+    {
+        (*session)->getListener().setHistogramItems(ConsoleUtils::Queue,
+            std::vector<size_t>(histogramItems.begin(), histogramItems.end()));
+    }
+    for (size_t bucket = 0; bucket < Histogram::BucketCount; ++bucket) {
+        histogram_domain(bucket, Histogram::getBucketName(bucket));
+    }
+    for (size_t index = 0; index < sizeof(percentiles) / sizeof(percentiles[0]); ++index) {
+        std::ostringstream name;
+        name << 'p' << percentiles[index];
+        percentile_domain(index, name.str());
+    }
+
+    // Subscribe to just the QMF classes we export (see getSessionSettings).
+    string_vector exportedClasses;
+    for (int type = 0; type < ConsoleUtils::Other; ++type) {
+        if (exported[type]) {
+            exportedClasses.push_back(
+                ConsoleUtils::getClassName(static_cast<ConsoleUtils::ObjectSchemaType>(type)));
+        }
+    }
+
+    // Start each broker's own QMF session, and add it to the connection and
+    // aggregate domains. Brokers connect in the background, and in parallel, so
+    // we can register with pmcd straight away; each broker's instances appear
+    // once it connects.
+    const qpid::console::SessionManager::Settings sessionSettings = getSessionSettings();
+    aggregate_domain(0, "all");
+    for (size_t index = 0; index < brokerSessions.size(); ++index) {
+        connection_domain(index, brokerSessions[index]->getName());
+        aggregate_domain(index + 1, brokerSessions[index]->getName());
+        brokerSessions[index]->start(sessionSettings, exportedClasses);
     }
 
     // If testing in non-PMDA mode, just wait for input then throw.
@@ -284,6 +575,20 @@ void QpidPmdaQmf1::initialize_pmda(pmdaInterface &interface)
 
     // Let the parent implementation initialize the rest of the PMDA.
     pcp::pmda::initialize_pmda(interface);
+
+    // Reuse the IDs of culled (deleted) instances, to keep our instances tables
+    // (which are indexed by instance ID) dense, despite any object churn.
+    #ifdef PMDA_CACHE_REUSE
+    pmdaCacheOp(broker_domain, PMDA_CACHE_REUSE);
+    pmdaCacheOp(queue_domain,  PMDA_CACHE_REUSE);
+    pmdaCacheOp(system_domain, PMDA_CACHE_REUSE);
+    #endif
+
+    // Serve the last known values until live QMF data arrives.
+    if (stateInterval > 0) {
+        loadState();
+        stateFile.start();
+    }
 }
 
 /**
@@ -299,11 +604,116 @@ void QpidPmdaQmf1::initialize_pmda(pmdaInterface &interface)
  * whether to fetch properties or statistics objects according to the cluster
  * index.
  *
+ * Clusters 0 to 5 are reserved for QMF objects in this way (though there are
+ * currently no system statistics). Clusters 6 and above describe this PMDA
+ * itself (including, in cluster 7, each broker's QMF session), and are not
+ * backed by QMF objects. Cluster 8 mirrors those of cluster 3's metrics that
+ * add up across queues (counters, and current levels such as msgDepth, but not
+ * watermarks nor latencies) as totals across all queues, per broker and across
+ * all brokers. Clusters 9 and 10 likewise mirror a few key queue statistics,
+ * as histograms of, and approximate percentiles across, all queues.
+ *
+ * Only metrics selected via the --include-metrics and --exclude-metrics command
+ * line options (if any) are returned. Clusters 8 to 10 are selected by their
+ * own names, regardless of whether cluster 3's metrics are. Since the
+ * ConsoleListener's record layouts are derived from these metrics (see
+ * initialize_pmda), QMF attributes for metrics that are not selected are
+ * discarded as soon as they arrive.
+ *
  * @return Descriptions of all of the metrics supported by this PMDA.
+ *
+ * @see getAllMetrics
+ * @see isMetricSelected
  */
 pcp::metrics_description QpidPmdaQmf1::get_supported_metrics()
 {
-    return pcp::metrics_description()
+    pcp::metrics_description metrics = getAllMetrics();
+    const pcp::metric_cluster queueStats = metrics.find(3)->second;
+
+    // Discard any metrics (and then clusters) not selected on the command line.
+    if ((!metricIncludes.empty()) || (!metricExcludes.empty())) {
+        for (pcp::metrics_description::iterator cluster = metrics.begin(); cluster != metrics.end();) {
+            for (pcp::metric_cluster::iterator item = cluster->second.begin();
+                 item != cluster->second.end();)
+            {
+                if (isMetricSelected(cluster->second.get_cluster_name() + '.' + item->second.metric_name)) {
+                    ++item;
+                } else {
+                    cluster->second.erase(item++);
+                }
+            }
+            if (cluster->second.empty()) {
+                metrics.erase(cluster++);
+            } else {
+                ++cluster;
+            }
+        }
+    }
+
+    // Total each selected additive queue statistic (see fetchAggregateValue).
+    pcp::metric_cluster aggregates;
+    for (pcp::metric_cluster::const_iterator item = queueStats.begin();
+         item != queueStats.end(); ++item)
+    {
+        if ((isAggregated(item->second)) &&
+            (isMetricSelected("aggregate.queue." + item->second.metric_name))) {
+            pcp::metric_description description(item->second);
+            description.domain = &aggregate_domain;
+            aggregates.insert(std::make_pair(item->first, description));
+        }
+    }
+    if (!aggregates.empty()) {
+        metrics(8, "aggregate.queue");
+        metrics.find(8)->second.insert(aggregates.begin(), aggregates.end());
+    }
+
+    // Histogram a few key queue statistics (see fetchHistogramValue).
+    pcp::metric_cluster percentileMetrics;
+    metrics(9, "histogram.queue");
+    for (pcp::metric_cluster::const_iterator item = queueStats.begin();
+         item != queueStats.end(); ++item)
+    {
+        const std::string &name = item->second.metric_name;
+        if (!isHistogrammed(name)) {
+            continue;
+        }
+        if (isMetricSelected("histogram.queue." + name)) {
+            metrics(item->first, name, pcp::type<uint64_t>(), PM_SEM_INSTANT,
+                    pcp::units(0,0,1, 0,0,PM_COUNT_ONE), &histogram_domain,
+                    "Number of queues per " + name + " bucket");
+        }
+        if (isMetricSelected("percentile.queue." + name)) {
+            pcp::metric_description description(item->second);
+            description.domain = &percentile_domain;
+            description.short_description = "Approximate percentiles of " + name + " across queues";
+            description.verbose_description.clear();
+            percentileMetrics.insert(std::make_pair(item->first, description));
+        }
+    }
+    if (metrics.find(9)->second.empty()) {
+        metrics.erase(9);
+    }
+    if (!percentileMetrics.empty()) {
+        metrics(10, "percentile.queue");
+        metrics.find(10)->second.insert(percentileMetrics.begin(), percentileMetrics.end());
+    }
+    return metrics;
+}
+
+/**
+ * @brief Get descriptions of all of the QMF object and PMDA metrics.
+ *
+ * Unlike get_supported_metrics, this ignores the --include-metrics and
+ * --exclude-metrics command line options, and excludes the derived clusters 8
+ * to 10.
+ *
+ * @return Descriptions of clusters 0 to 7's metrics.
+ *
+ * @see get_supported_metrics
+ */
+pcp::metrics_description QpidPmdaQmf1::getAllMetrics()
+{
+    pcp::metrics_description metrics = pcp::metrics_description()
     (0, "broker") // org.apache.qpid.broker::broker::properties
         (0, "connBacklog", pcp::type<uint16_t>(), PM_SEM_DISCRETE,
          pcp::units(0,0,0, 0,0,0), &broker_domain,
@@ -604,67 +1014,525 @@ pcp::metrics_description QpidPmdaQmf1::get_supported_metrics()
         (4, "version", pcp::type<std::string>(), PM_SEM_DISCRETE,
          pcp::units(0,0,0, 0,0,0), &system_domain, "System version")
         (5, "systemId", pcp::type<std::string>(), PM_SEM_DISCRETE,
-         pcp::units(0,0,0, 0,0,0), &system_domain, "System UUID");
+         pcp::units(0,0,0, 0,0,0), &system_domain, "System UUID")
+    (6, "pmda") // This PMDA's own metrics.
+        (0, "coalescedUpdates", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "QMF updates superseded before being applied")
+        (1, "droppedUpdates", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "QMF updates dropped due to too many pending updates")
+        (2, "pendingUpdates", pcp::type<uint32_t>(), PM_SEM_INSTANT,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "QMF objects with updates not yet applied")
+        (3, "updateGeneration", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "QMF update generation, across all brokers")
+        (4, "evictedObjects", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "QMF objects evicted due to instance limits")
+        (5, "rejectedObjects", pcp::type<uint32_t>(), PM_SEM_INSTANT,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "QMF objects currently rejected by auto-delete or queue filters")
+        (6, "staleInstances", pcp::type<uint32_t>(), PM_SEM_INSTANT,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "Instances still serving last known values from the state file")
+        (7, "brokerIndomGeneration", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "Number of batches of broker instances added or removed")
+        (8, "queueIndomGeneration", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "Number of batches of queue instances added or removed")
+        (9, "systemIndomGeneration", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), NULL,
+         "Number of batches of system instances added or removed")
+    (7, "connection") // Per-broker QMF session health.
+        (0, "connected", pcp::type<uint32_t>(), PM_SEM_DISCRETE,
+         pcp::units(0,0,0, 0,0,0), &connection_domain,
+         "Whether the broker's QMF session is currently connected (1) or not (0)")
+        (1, "connects", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), &connection_domain,
+         "Number of times the broker's QMF session has connected")
+        (2, "updateAge", pcp::type<uint32_t>(), PM_SEM_INSTANT,
+         pcp::units(0,1,0, 0,PM_TIME_SEC,0), &connection_domain,
+         "Time since QMF updates were last applied for the broker")
+        (3, "pendingUpdates", pcp::type<uint32_t>(), PM_SEM_INSTANT,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), &connection_domain,
+         "The broker's QMF objects with updates not yet applied")
+        (4, "droppedUpdates", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), &connection_domain,
+         "The broker's QMF updates dropped due to too many pending updates")
+        (5, "updateGeneration", pcp::type<uint64_t>(), PM_SEM_COUNTER,
+         pcp::units(0,0,1, 0,0,PM_COUNT_ONE), &connection_domain,
+         "The broker's QMF update generation");
+    return metrics;
+}
+
+/**
+ * @brief Is a metric selected by the --include-metrics and --exclude-metrics
+ *        command line options?
+ *
+ * @param name Metric name, relative to this PMDA (eg "queue.msgDepth").
+ *
+ * @return \c true if \a name matches any include glob (or there are none),
+ *         and no exclude globs.
+ */
+bool QpidPmdaQmf1::isMetricSelected(const std::string &name) const
+{
+    return ConsoleUtils::matchesGlobs(name, metricIncludes, metricExcludes);
 }
 
 /**
  * @brief Begin fetching values.
  *
  * This override checks to see if any new QMF objects have been discovered (via
- * ConsoleListener::getNewObjectId), and if so, registers any such new objects
- * via PCP's cache.
+ * ConsoleListener::takeNewObjects), and if so, registers any such new objects
+ * via PCP's cache. It also releases any instances resolved by the previous
+ * fetch, so that this fetch will see the latest QMF snapshots, and drops any
+ * instances whose QMF objects were deleted more than the grace period ago, or
+ * were evicted due to object limits.
+ *
+ * If the QMF data is older than the --max-staleness command line option, or
+ * in passive mode, those brokers whose data is too old are queried directly
+ * first (see BrokerSession::requestRefresh). All such brokers are queried in
+ * parallel, and waited for until a single deadline - the --query-timeout, but
+ * no more than a few seconds, to stay within pmcd's own timeout. Any brokers
+ * still not refreshed by then are reported with their older data.
  *
- * @see ConsoleListener::getNewObjectId
+ * However, if no QMF updates have been applied since the previous fetch (ie
+ * the brokers' ConsoleListener generations are unchanged), then the previous fetch's
+ * snapshots are still the latest, so they are kept for reuse by this fetch.
+ * This makes repeated fetches by several PCP clients between QMF publishes
+ * nearly free, since every value is already decoded and resolved.
+ *
+ * Finally, any stale instances (see loadState) are dropped once their grace
+ * period expires, and the current state is saved every --state-interval
+ * seconds (see saveState).
+ *
+ * @see ConsoleListener::takeNewObjects
  * @see pmdaCacheStoreKey
  */
 void QpidPmdaQmf1::begin_fetch_values()
 {
-    // For all new QMF object IDs (if any)
-    boost::optional<qpid::console::ObjectId> objectId;
-    while ((objectId = consoleListener.getNewObjectId())) {
+    // Forget the previous fetch's combined histograms (see fetchHistogramValue).
+    fetchHistograms.clear();
+
+    // Query any brokers directly whose data is too stale.
+    if ((passiveMode) || (maxStaleness > 0)) {
+        std::vector<boost::shared_ptr<BrokerSession> > refreshing;
+        for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = brokerSessions.begin();
+             session != brokerSessions.end(); ++session)
+        {
+            if ((*session)->requestRefresh(maxStaleness)) {
+                refreshing.push_back(*session);
+            }
+        }
+        const boost::system_time deadline = boost::get_system_time() +
+            boost::posix_time::seconds(std::min(queryTimeout, maxRefreshWait));
+        for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = refreshing.begin();
+             session != refreshing.end(); ++session)
+        {
+            if ((!(*session)->waitForRefresh(deadline)) && (pmDebug & DBG_TRACE_APPL0)) {
+                __pmNotifyErr(LOG_DEBUG, "%s gave up waiting for broker %s to refresh",
+                              __FUNCTION__, (*session)->getName().c_str());
+            }
+        }
+    }
+
+    // Register new objects, but only if QMF updates have been applied since
+    // the last fetch; otherwise there can be none, and the last fetch's
+    // resolved snapshots are still the latest.
+    const uint64_t generation = sumListeners(&ConsoleListener::getGeneration);
+    if (generation != fetchGeneration) {
+        fetchGeneration = generation;
+        registerNewInstances();
+    }
+
+    // Drop any deleted QMF objects whose grace period has expired, and any
+    // objects evicted due to object limits.
+    std::vector<ObjectEntry::Ptr> expired;
+    for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = brokerSessions.begin();
+         session != brokerSessions.end(); ++session)
+    {
+        (*session)->getListener().takeExpiredObjects(expired);
+    }
+    dropInstances(expired);
+
+    // Drop any stale instances not yet taken over by live QMF objects.
+    if ((!staleEntries.empty()) && (time(NULL) >= staleExpiryTime)) {
+        __pmNotifyErr(LOG_INFO, "dropping %ju stale instances", (uintmax_t)staleCount);
+        dropInstances(staleEntries);
+        staleEntries.clear();
+    }
+
+    // Periodically save the current state, for a warm restart.
+    if ((stateInterval > 0) && (time(NULL) - lastStateSaveTime >= stateInterval)) {
+        lastStateSaveTime = time(NULL);
+        saveState();
+    }
+}
+
+/**
+ * @brief Register new QMF objects as PCP instances.
+ *
+ * This also releases any instances resolved by the previous fetch, so that the
+ * current fetch will see the latest QMF snapshots.
+ *
+ * @see begin_fetch_values
+ */
+void QpidPmdaQmf1::registerNewInstances()
+{
+    // Release the snapshots taken during the previous fetch.
+    for (std::vector<std::pair<unsigned int, unsigned int> >::const_iterator iter = resolvedInstances.begin();
+         iter != resolvedInstances.end(); ++iter)
+    {
+        Instance &instance = instances[iter->first].at(iter->second);
+        instance.props.reset();
+        instance.stats.reset();
+        instance.resolved = false;
+    }
+    resolvedInstances.clear();
+
+    // Take all new QMF objects (if any) at once, and register them together.
+    std::vector<ObjectEntry::Ptr> entries;
+    for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator session = brokerSessions.begin();
+         session != brokerSessions.end(); ++session)
+    {
+        (*session)->getListener().takeNewObjects(entries);
+    }
+    if (!entries.empty()) {
+        registerInstances(entries);
+    }
+}
+
+/**
+ * @brief Register QMF objects as PCP instances, in a single batch per domain.
+ *
+ * Objects are first validated and grouped by instance domain, then registered
+ * domain by domain, so each domain's cache and instances table is updated in
+ * one pass.
+ *
+ * Objects that cannot be registered (ie ones already dropped, or without
+ * properties, a supported type, or a name) are skipped individually, without
+ * affecting the rest of the batch. Registered objects' entries have their
+ * instance IDs set.
+ *
+ * If another object is already registered under the same name (eg a stale
+ * instance loaded by loadState), the new object takes over its instance ID.
+ *
+ * @param entries Entries of the QMF objects to register.
+ *
+ * @return The number of objects registered.
+ */
+size_t QpidPmdaQmf1::registerInstances(const std::vector<ObjectEntry::Ptr> &entries)
+{
+    // Group the objects by type, skipping any that cannot be registered.
+    std::vector<std::pair<ObjectEntry::Ptr, ObjectEntry::Snapshot> > batches[ConsoleUtils::Other];
+    for (std::vector<ObjectEntry::Ptr>::const_iterator entry = entries.begin();
+         entry != entries.end(); ++entry)
+    {
+        // Skip objects already dropped (eg evicted) before they were registered.
+        if ((*entry)->getInstanceId() == ObjectEntry::DroppedInstance) {
+            continue;
+        }
+
         // Get the new object's properties.
-        const boost::optional<qpid::console::Object> props = consoleListener.getProps(*objectId);
+        const qpid::console::ObjectId &objectId = (*entry)->getObjectId();
+        const ObjectEntry::Snapshot props = (*entry)->getProps();
         if (!props) {
             __pmNotifyErr(LOG_NOTICE, "No properties found for object %s",
-                          ConsoleUtils::toString(*objectId).c_str());
-        } else {
-            // Determine which instance domain the new object is an instance of.
-            const ConsoleUtils::ObjectSchemaType type = ConsoleUtils::getType(*props);
-            pcp::instance_domain * domain = NULL;
-            switch (type) {
-                case ConsoleUtils::Broker:
-                    domain = &broker_domain;
-                    break;
-                case ConsoleUtils::Queue:
-                    domain = &queue_domain;
-                    break;
-                case ConsoleUtils::System:
-                    domain = &system_domain;
-                    break;
-                default:
-                    __pmNotifyErr(LOG_ERR, "%s has unsupported type",
-                                  ConsoleUtils::toString(*objectId).c_str());
-                    return;
+                          ConsoleUtils::toString(objectId).c_str());
+            continue;
+        }
+
+        // Determine which instance domain the new object is an instance of.
+        if (getDomain(props->getType()) == NULL) {
+            __pmNotifyErr(LOG_ERR, "%s has unsupported type",
+                          ConsoleUtils::toString(objectId).c_str());
+            continue;
+        }
+
+        // Get a canonical name for the new object.
+        if (props->getName().empty()) {
+            __pmNotifyErr(LOG_WARNING, "%s has no name attribute",
+                          ConsoleUtils::toString(objectId).c_str());
+            continue;
+        }
+        batches[props->getType()].push_back(std::make_pair(*entry, props));
+    }
+
+    // Register each domain's batch.
+    size_t count = 0;
+    for (int type = 0; type < ConsoleUtils::Other; ++type) {
+        std::vector<std::pair<ObjectEntry::Ptr, ObjectEntry::Snapshot> > &batch = batches[type];
+        if (batch.empty()) {
+            continue;
+        }
+        pcp::instance_domain &domain =
+            *getDomain(static_cast<ConsoleUtils::ObjectSchemaType>(type));
+        std::vector<Instance> &table = instances[type];
+        bool changed = false;
+        for (std::vector<std::pair<ObjectEntry::Ptr, ObjectEntry::Snapshot> >::const_iterator
+             iter = batch.begin(); iter != batch.end(); ++iter)
+        {
+            // Get a PCP instance ID by storing the new object's name in PCP's
+            // cache. We keep no opaque data there, since the instances table
+            // (below) maps instance IDs straight back to the QMF object. The
+            // cache is authoritative for these instance domains, so the name
+            // is not added to the pcp::instance_domain itself, which would
+            // otherwise grow with every name ever seen.
+            const std::string &instanceName = iter->second->getName();
+            const int instanceId = pcp::cache::store(
+                domain, instanceName, static_cast<void *>(NULL));
+
+            // Index the new object by its PCP instance ID.
+            // An object taking over an existing instance (eg a stale one)
+            // leaves the instance domain itself unchanged.
+            if (static_cast<size_t>(instanceId) >= table.size()) {
+                table.resize(instanceId + 1);
+            }
+            changed = changed || (!table[instanceId].entry);
+            if (table[instanceId].stale) {
+                table[instanceId].stale = false;
+                --staleCount;
             }
+            table[instanceId].entry = iter->first;
+            iter->first->setInstanceId(instanceId);
+        }
+        count += batch.size();
+        if (changed) {
+            markIndomChanged(static_cast<ConsoleUtils::ObjectSchemaType>(type));
+        }
+        if (pmDebug & DBG_TRACE_APPL0) {
+            __pmNotifyErr(LOG_DEBUG, "%s registered %ju %s instances", __FUNCTION__,
+                          (uintmax_t)batch.size(), ConsoleUtils::getClassName(
+                              static_cast<ConsoleUtils::ObjectSchemaType>(type)).c_str());
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Load the instances saved by a previous run, for a warm restart.
+ *
+ * PCP's cache is loaded first, so that each saved object is registered under
+ * the same instance ID it had before the restart. Any object that nonetheless
+ * gets a different ID than the state file recorded (eg if PCP's cache file was
+ * lost) is logged.
+ *
+ * Saved objects whose snapshots do not match this run's record layouts (eg
+ * saved by another build, or with other metrics selected, or corrupt) are
+ * discarded, since their values could be misinterpreted (see
+ * ObjectRecord::matches).
+ *
+ * The saved objects are then served straight away, until live QMF objects of
+ * the same names take their instances over, or until the --delete-grace period
+ * expires, whichever comes first. PCP values carry no per-value staleness flag,
+ * and exporting one per instance would double the size of every fetch, so stale
+ * values are served just like live ones. Instead, the qpid.pmda.staleInstances
+ * metric reports how many instances are still stale, reaching zero once live
+ * data has taken over (or the stale instances have been dropped).
+ *
+ * @see saveState
+ * @see StateFile::load
+ */
+void QpidPmdaQmf1::loadState()
+{
+    pmdaCacheOp(broker_domain, PMDA_CACHE_LOAD);
+    pmdaCacheOp(queue_domain,  PMDA_CACHE_LOAD);
+    pmdaCacheOp(system_domain, PMDA_CACHE_LOAD);
 
-            // Get a canonical name for the new object.
-            const std::string instanceName = ConsoleUtils::getName(*props);
-            if (instanceName.empty()) {
-                __pmNotifyErr(LOG_WARNING, "%s has no name attribute",
-                              ConsoleUtils::toString(*objectId).c_str());
-                return;
+    std::vector<StateFile::Instance> loaded, saved;
+    stateFile.load(loaded);
+    std::vector<ObjectEntry::Ptr> entries;
+    entries.reserve(loaded.size());
+    for (std::vector<StateFile::Instance>::const_iterator iter = loaded.begin();
+         iter != loaded.end(); ++iter)
+    {
+        const ObjectEntry::Snapshot props = iter->second->getProps();
+        const ObjectEntry::Snapshot stats = iter->second->getStats();
+        if ((props) && (stats) && (props->getType() < ConsoleUtils::Other) &&
+            (stats->getType() == props->getType()) &&
+            (props->matches(layouts[props->getType()][0])) &&
+            (stats->matches(layouts[props->getType()][1]))) {
+            saved.push_back(*iter);
+            entries.push_back(iter->second);
+        }
+    }
+    if (saved.size() < loaded.size()) {
+        __pmNotifyErr(LOG_WARNING, "discarded %ju of %ju saved objects not matching current metrics",
+                      (uintmax_t)(loaded.size() - saved.size()), (uintmax_t)loaded.size());
+    }
+    registerInstances(entries);
+
+    // Mark the saved objects' instances as stale, until taken over or dropped.
+    size_t moved = 0;
+    for (std::vector<StateFile::Instance>::const_iterator iter = saved.begin();
+         iter != saved.end(); ++iter)
+    {
+        const int instanceId = iter->second->getInstanceId();
+        if (instanceId < 0) {
+            continue;
+        }
+        Instance &instance = instances[iter->second->getProps()->getType()].at(instanceId);
+        if ((instance.entry == iter->second) && (!instance.stale)) {
+            instance.stale = true;
+            ++staleCount;
+            staleEntries.push_back(iter->second);
+        }
+        if (instanceId != iter->first) {
+            ++moved;
+        }
+    }
+    if (moved > 0) {
+        __pmNotifyErr(LOG_WARNING, "%ju of %ju saved instances could not keep their IDs",
+                      (uintmax_t)moved, (uintmax_t)saved.size());
+    }
+    staleExpiryTime = time(NULL) + staleGracePeriod;
+    lastStateSaveTime = time(NULL);
+}
+
+/**
+ * @brief Save the current instances, and their last known values.
+ *
+ * PCP's cache (ie the instance name to ID maps) is saved synchronously, since
+ * it is not thread-safe, but only does any I/O if instances have changed, and
+ * only every --state-interval seconds. The instances' snapshots are handed to
+ * the state file's own thread to write, so the fetch path never waits for them
+ * to be written.
+ *
+ * @see loadState
+ * @see StateFile::save
+ */
+void QpidPmdaQmf1::saveState()
+{
+    pmdaCacheOp(broker_domain, PMDA_CACHE_SAVE);
+    pmdaCacheOp(queue_domain,  PMDA_CACHE_SAVE);
+    pmdaCacheOp(system_domain, PMDA_CACHE_SAVE);
+
+    std::vector<StateFile::Instance> saved;
+    for (int type = 0; type < ConsoleUtils::Other; ++type) {
+        for (size_t instanceId = 0; instanceId < instances[type].size(); ++instanceId) {
+            if (instances[type][instanceId].entry) {
+                saved.push_back(std::make_pair(static_cast<int>(instanceId),
+                                               instances[type][instanceId].entry));
             }
+        }
+    }
+    stateFile.save(saved);
+}
 
-            // Get a PCP instance ID by storing the new object in PCP's cache.
-            const int instanceId = pcp::cache::store(
-                *domain, instanceName, new qpid::console::ObjectId(*objectId));
+/**
+ * @brief Drop the PCP instance of a QMF object.
+ *
+ * The instance is culled from PCP's cache, and removed from our instances
+ * table, releasing this PMDA's references to the object's snapshots.
+ *
+ * If the object's instance has since been taken over by a newer object of the
+ * same name (eg a queue deleted and then re-declared), then nothing is dropped.
+ *
+ * Either way, the entry is marked as dropped, so that it will never be
+ * registered as an instance, even if still awaiting registration.
+ *
+ * @note This does not mark the instance domain as changed; callers should do
+ *       that once per batch of drops (see dropInstances).
+ *
+ * @param entry Entry of the QMF object to drop.
+ *
+ * @return The type of the instance dropped, or ConsoleUtils::Other if none
+ *         was dropped.
+ */
+ConsoleUtils::ObjectSchemaType QpidPmdaQmf1::dropInstance(ObjectEntry &entry)
+{
+    const ObjectEntry::Snapshot props = entry.getProps();
+    const int instanceId = entry.getInstanceId();
+    entry.setInstanceId(ObjectEntry::DroppedInstance);
+    if ((!props) || (instanceId < 0)) {
+        return ConsoleUtils::Other; // Never registered as a PCP instance.
+    }
+
+    std::vector<Instance> &table = instances[props->getType()];
+    if ((static_cast<size_t>(instanceId) >= table.size()) ||
+        (table[instanceId].entry.get() != &entry)) {
+        return ConsoleUtils::Other; // Instance now belongs to a newer object.
+    }
+
+    if (pmDebug & DBG_TRACE_APPL0) {
+        __pmNotifyErr(LOG_DEBUG, "dropping instance %d (%s)", instanceId,
+                      props->getName().c_str());
+    }
+    pmdaCacheStore(*getDomain(props->getType()), PMDA_CACHE_CULL,
+                   props->getName().c_str(), NULL);
+    if (table[instanceId].stale) {
+        --staleCount;
+    }
+    table[instanceId] = Instance();
+    return props->getType();
+}
 
-            // Add this new instance to the selected instance domain.
-            (*domain)(instanceId, instanceName);
+/**
+ * @brief Drop the PCP instances of a batch of QMF objects.
+ *
+ * Each instance domain changed by the batch is marked as changed just once.
+ *
+ * @param entries Entries of the QMF objects to drop.
+ *
+ * @see dropInstance
+ */
+void QpidPmdaQmf1::dropInstances(const std::vector<ObjectEntry::Ptr> &entries)
+{
+    bool changed[ConsoleUtils::Other + 1] = { false };
+    for (std::vector<ObjectEntry::Ptr>::const_iterator iter = entries.begin();
+         iter != entries.end(); ++iter)
+    {
+        changed[dropInstance(**iter)] = true;
+    }
+    for (int type = 0; type < ConsoleUtils::Other; ++type) {
+        if (changed[type]) {
+            markIndomChanged(static_cast<ConsoleUtils::ObjectSchemaType>(type));
         }
     }
 }
 
+/**
+ * @brief Get the PCP instance domain for a QMF object type.
+ *
+ * @param type QMF object type.
+ *
+ * @return The instance domain for \a type, or \c NULL if \a type is not
+ *         supported.
+ */
+pcp::instance_domain * QpidPmdaQmf1::getDomain(const ConsoleUtils::ObjectSchemaType type)
+{
+    switch (type) {
+        case ConsoleUtils::Broker: return &broker_domain;
+        case ConsoleUtils::Queue:  return &queue_domain;
+        case ConsoleUtils::System: return &system_domain;
+        default:                   return NULL;
+    }
+}
+
+/**
+ * @brief Record that a QMF object type's instance domain has changed.
+ *
+ * This advances the type's instance domain generation (exported as one of the
+ * qpid.pmda.*IndomGeneration metrics), once per batch of instances added (see
+ * registerInstances) or removed (see dropInstances). Clients, such as pmie
+ * rules or monitoring scripts, can therefore watch these metrics to skip
+ * re-reading large instance domains, such as queues, until they have actually
+ * changed.
+ *
+ * @note PCP itself has no instance domain change notification: its PMDA change
+ *       flags (PMDA_EXT_LABEL_CHANGE, PMDA_EXT_NAMES_CHANGE) cover only labels
+ *       and the namespace, so none are set here.
+ *
+ * @param type QMF object type whose instance domain has changed.
+ */
+void QpidPmdaQmf1::markIndomChanged(const ConsoleUtils::ObjectSchemaType type)
+{
+    ++indomGenerations[type];
+}
+
 /**
  * @brief Fetch an individual metric value.
  *
@@ -677,88 +1545,266 @@ void QpidPmdaQmf1::begin_fetch_values()
  */
 pcp::pmda::fetch_value_result QpidPmdaQmf1::fetch_value(const metric_id &metric)
 {
-    // Get the metric's instance domain.
-    pcp::instance_domain * domain = NULL;
-    switch (metric.cluster) {
-        case 0:
-        case 1:
-            domain = &broker_domain;
-            break;
-        case 2:
-        case 3:
-            domain = &queue_domain;
-            break;
-        case 4:
-            domain = &system_domain;
-            break;
-    }
-
-    // Fetch the Qpid objectId from the PMDA cache (we added in begin_fetch_values).
-    const qpid::console::ObjectId * const objectId =
-        pcp::cache::lookup<const qpid::console::ObjectId *>(*domain, metric.instance).opaque;
-    if (objectId == NULL) {
-        __pmNotifyErr(LOG_ERR, "pcp::cache::lookup returned NULL for cluster %ju",
-                      (uintmax_t)metric.cluster);
-        throw pcp::exception(PM_ERR_INST);
+    // This PMDA's own metrics are not backed by QMF objects.
+    if (metric.cluster == 6) {
+        return fetchPmdaValue(metric);
+    } else if (metric.cluster == 7) {
+        return fetchConnectionValue(metric);
+    } else if (metric.cluster == 8) {
+        return fetchAggregateValue(metric);
+    } else if ((metric.cluster == 9) || (metric.cluster == 10)) {
+        return fetchHistogramValue(metric);
     }
 
     // Fetch the object's propeties or statistics, according to the metric cluster.
-    const boost::optional<qpid::console::Object> object = (metric.cluster % 2 == 0)
-        ? consoleListener.getProps(*objectId) : consoleListener.getStats(*objectId);
+    // These are shared, immutable snapshots, so no QMF objects are copied here.
+    const Instance &instance = resolveInstance(metric);
+    const ObjectEntry::Snapshot &object = (metric.cluster % 2 == 0)
+        ? instance.props : instance.stats;
     if (!object) {
         __pmNotifyErr(LOG_NOTICE, "no %s for %s",
                       (metric.cluster % 2 == 0) ? "properties" : "statistics",
-                      ConsoleUtils::toString(*object).c_str());
+                      ConsoleUtils::toString(instance.entry->getObjectId()).c_str());
         throw pcp::exception(PM_ERR_INST);
     }
 
-    // Get the name of metric corresponding to the metric item, and fetch the metric.
-    const std::string &metricName = supported_metrics.at(metric.cluster).at(metric.item).metric_name;
-    const qpid::console::Object::AttributeMap &attributes = object->getAttributes();
-    const qpid::console::Object::AttributeMap::const_iterator attribute = attributes.find(metricName);
-    if (attribute == attributes.end()) {
-        __pmNotifyErr(LOG_NOTICE, "no %s metric found for %s", metricName.c_str(),
-                      ConsoleUtils::toString(*object).c_str());
-        throw pcp::exception(PM_ERR_VALUE);
+    // Get the metric value that was decoded when the object arrived.
+    const ObjectRecord::Slot * const slot = object->getSlot(metric.item);
+    if ((slot == NULL) || (slot->status != 0)) {
+        __pmNotifyErr(LOG_NOTICE, "no metric %ju found for %s", (uintmax_t)metric.item,
+                      ConsoleUtils::toString(instance.entry->getObjectId()).c_str());
+        throw pcp::exception((slot == NULL) ? PM_ERR_VALUE : slot->status);
     }
 
     // Return the metric value as a PCP atom.
-    try{
-        switch (metric.type) {
-            case PM_TYPE_32:     return pcp::atom(metric.type, attribute->second->asInt());
-            case PM_TYPE_64:     return pcp::atom(metric.type, attribute->second->asInt64());
-            case PM_TYPE_U32:    return pcp::atom(metric.type, attribute->second->asUint());
-            case PM_TYPE_U64:    return pcp::atom(metric.type, attribute->second->asUint64());
-            case PM_TYPE_FLOAT:  return pcp::atom(metric.type, attribute->second->asFloat());
-            case PM_TYPE_DOUBLE: return pcp::atom(metric.type, attribute->second->asDouble());
-            case PM_TYPE_STRING:
-                if (attribute->second->isBool()) {
-                    return pcp::atom(metric.type, strdup(
-                        attribute->second->asBool() ? "true" : "false"));
-                } else if (attribute->second->isMap()) {
-                    std::ostringstream stream;
-                    stream << attribute->second->asMap();
-                    return pcp::atom(metric.type, strdup(stream.str().c_str()));
-                } else if (attribute->second->isNull()) {
-                    return pcp::atom(metric.type, strdup("null"));
-                } else if (attribute->second->isObjectId()) {
-                    return pcp::atom(metric.type, strdup(
-                        ConsoleUtils::toString(attribute->second->asObjectId()).c_str()));
-                } else if (attribute->second->isUuid()) {
-                    return pcp::atom(metric.type, strdup(
-                        attribute->second->asUuid().str().c_str()));
-                } else {
-                    return pcp::atom(metric.type, strdup(
-                        attribute->second->asString().c_str()));
-                }
-            default:
-                __pmNotifyErr(LOG_ERR, "%s metric uses unsupported type %d",
-                              metricName.c_str(), metric.type);
-                throw pcp::exception(PM_ERR_TYPE);
-        }
-    } catch (const qpid::Exception &ex) {
-        __pmNotifyErr(LOG_ERR, "error converting %s metric to type %d: %s",
-                      metricName.c_str(), metric.type, ex.what());
-        throw pcp::exception(PM_ERR_TYPE, ex.getMessage());
+    switch (metric.type) {
+        case PM_TYPE_32:
+        case PM_TYPE_64:
+        case PM_TYPE_U32:
+        case PM_TYPE_U64:
+        case PM_TYPE_FLOAT:
+        case PM_TYPE_DOUBLE:
+            return slot->atom;
+        case PM_TYPE_STRING: {
+            // The string was rendered when the object arrived, and its record
+            // stays pinned until the next fetch, so no copy is needed here.
+            pmAtomValue atom;
+            atom.cp = const_cast<char *>(ObjectRecord::getString(*slot));
+            return fetch_value_result(atom, PMDA_FETCH_STATIC);
+        }
+        default:
+            __pmNotifyErr(LOG_ERR, "metric %ju uses unsupported type %d",
+                          (uintmax_t)metric.item, metric.type);
+            throw pcp::exception(PM_ERR_TYPE);
+    }
+}
+
+/**
+ * @brief Resolve a metric's instance to its QMF object snapshots.
+ *
+ * A single pmFetch request typically asks for many metrics of every instance.
+ * So rather than reloading an instance's snapshots for every metric value, this
+ * function resolves each instance once per fetch, taking both its properties
+ * and statistics snapshots together.
+ *
+ * Every value fetched for an instance during a single fetch request therefore
+ * comes from the same pair of snapshots, even if newer QMF updates arrive
+ * mid-fetch. The snapshots are released by the next begin_fetch_values call.
+ *
+ * Instances are indexed directly by PCP instance ID, so this is a constant-time
+ * operation, without any PCP cache, or ConsoleListener, lookups.
+ *
+ * @param metric The metric whose instance is to be resolved.
+ *
+ * @throw pcp::exception if the instance is not known to this PMDA.
+ *
+ * @return The resolved instance.
+ */
+const QpidPmdaQmf1::Instance &QpidPmdaQmf1::resolveInstance(const metric_id &metric)
+{
+    // Find the instance, by object type (according to metric cluster) and ID.
+    const unsigned int type = metric.cluster / 2;
+    if ((type >= ConsoleUtils::Other) || (metric.instance >= instances[type].size()) ||
+        (!instances[type][metric.instance].entry)) {
+        __pmNotifyErr(LOG_ERR, "unknown instance %ju for cluster %ju",
+                      (uintmax_t)metric.instance, (uintmax_t)metric.cluster);
+        throw pcp::exception(PM_ERR_INST);
+    }
+    Instance &instance = instances[type][metric.instance];
+
+    // Take the object's snapshots, for use by the rest of this fetch.
+    if (!instance.resolved) {
+        instance.props = instance.entry->getProps();
+        instance.stats = instance.entry->getStats();
+        instance.resolved = true;
+        resolvedInstances.push_back(std::make_pair(type, metric.instance));
+    }
+    return instance;
+}
+
+/**
+ * @brief Fetch the value of one of this PMDA's own metrics.
+ *
+ * @param metric The metric to fetch the value of.
+ *
+ * @throw pcp::exception if \a metric is not known.
+ *
+ * @return The value of the requested metric.
+ */
+pcp::pmda::fetch_value_result QpidPmdaQmf1::fetchPmdaValue(const metric_id &metric)
+{
+    switch (metric.item) {
+        case 0: return pcp::atom(metric.type, sumListeners(&ConsoleListener::getCoalescedUpdates));
+        case 1: return pcp::atom(metric.type, sumListeners(&ConsoleListener::getDroppedUpdates));
+        case 2: return pcp::atom(metric.type, static_cast<uint32_t>(
+                                     sumListeners(&ConsoleListener::getPendingUpdates)));
+        case 3: return pcp::atom(metric.type, sumListeners(&ConsoleListener::getGeneration));
+        case 4: return pcp::atom(metric.type, sumListeners(&ConsoleListener::getEvictedCount));
+        case 5: return pcp::atom(metric.type, static_cast<uint32_t>(
+                                     sumListeners(&ConsoleListener::getRejectedCount)));
+        case 6: return pcp::atom(metric.type,
+                                 static_cast<uint32_t>(staleCount));
+        case 7: return pcp::atom(metric.type, indomGenerations[ConsoleUtils::Broker]);
+        case 8: return pcp::atom(metric.type, indomGenerations[ConsoleUtils::Queue]);
+        case 9: return pcp::atom(metric.type, indomGenerations[ConsoleUtils::System]);
+    }
+    __pmNotifyErr(LOG_ERR, "unknown metric %ju for cluster %ju",
+                  (uintmax_t)metric.item, (uintmax_t)metric.cluster);
+    throw pcp::exception(PM_ERR_PMID);
+}
+
+/**
+ * @brief Fetch the value of one of this PMDA's per-broker connection metrics.
+ *
+ * These report the health of each broker's own QMF session, as indexed by
+ * connection instance ID.
+ *
+ * @param metric The metric to fetch the value of.
+ *
+ * @throw pcp::exception if \a metric, or its instance, is not known.
+ *
+ * @return The value of the requested metric.
+ */
+pcp::pmda::fetch_value_result QpidPmdaQmf1::fetchConnectionValue(const metric_id &metric)
+{
+    if (metric.instance >= brokerSessions.size()) {
+        __pmNotifyErr(LOG_ERR, "unknown instance %ju for cluster %ju",
+                      (uintmax_t)metric.instance, (uintmax_t)metric.cluster);
+        throw pcp::exception(PM_ERR_INST);
+    }
+    const ConsoleListener &listener = brokerSessions[metric.instance]->getListener();
+    switch (metric.item) {
+        case 0: return pcp::atom(metric.type, static_cast<uint32_t>(listener.isConnected()));
+        case 1: return pcp::atom(metric.type, listener.getConnectCount());
+        case 2: {
+            const time_t lastUpdateTime = listener.getLastUpdateTime();
+            if (lastUpdateTime == 0) {
+                throw pcp::exception(PM_ERR_VALUE); // No updates yet.
+            }
+            return pcp::atom(metric.type, static_cast<uint32_t>(time(NULL) - lastUpdateTime));
+        }
+        case 3: return pcp::atom(metric.type, static_cast<uint32_t>(listener.getPendingUpdates()));
+        case 4: return pcp::atom(metric.type, listener.getDroppedUpdates());
+        case 5: return pcp::atom(metric.type, listener.getGeneration());
+    }
+    __pmNotifyErr(LOG_ERR, "unknown metric %ju for cluster %ju",
+                  (uintmax_t)metric.item, (uintmax_t)metric.cluster);
+    throw pcp::exception(PM_ERR_PMID);
+}
+
+/**
+ * @brief Fetch the total of a queue statistic, for one or all brokers.
+ *
+ * Each broker's totals are maintained incrementally by its ConsoleListener as
+ * QMF statistics arrive, so this never iterates over the queues themselves;
+ * the "all" instance (ID 0) just sums the per-broker totals, and broker
+ * instances are indexed by connection instance ID + 1.
+ *
+ * @param metric The metric to fetch the value of.
+ *
+ * @throw pcp::exception if \a metric, or its instance, is not known.
+ *
+ * @return The value of the requested metric.
+ */
+pcp::pmda::fetch_value_result QpidPmdaQmf1::fetchAggregateValue(const metric_id &metric)
+{
+    if (metric.instance > brokerSessions.size()) {
+        __pmNotifyErr(LOG_ERR, "unknown instance %ju for cluster %ju",
+                      (uintmax_t)metric.instance, (uintmax_t)metric.cluster);
+        throw pcp::exception(PM_ERR_INST);
+    }
+    const size_t begin = (metric.instance == 0) ? 0 : metric.instance - 1;
+    const size_t end = (metric.instance == 0) ? brokerSessions.size() : metric.instance;
+    pmAtomValue total;
+    total.ull = 0;
+    for (size_t index = begin; index < end; ++index) {
+        pmAtomValue value;
+        if (!brokerSessions[index]->getListener().getAggregate(ConsoleUtils::Queue, metric.item, value)) {
+            __pmNotifyErr(LOG_ERR, "unknown metric %ju for cluster %ju",
+                          (uintmax_t)metric.item, (uintmax_t)metric.cluster);
+            throw pcp::exception(PM_ERR_PMID);
+        }
+        ObjectRecord::addAtom(total, value, metric.type);
+    }
+    return total;
+}
+
+/**
+ * @brief Fetch a queue histogram bucket, or approximate percentile.
+ *
+ * Each broker's histograms are maintained incrementally by its ConsoleListener
+ * as QMF statistics arrive, so this just sums a fixed number of buckets per
+ * broker, regardless of how many queues there are. Each item's histograms are
+ * summed just once per fetch (see fetchHistograms), on first use, and shared
+ * by all of that item's buckets and percentiles. Cluster 9's instances are
+ * histogram buckets, and cluster 10's are percentiles, each the upper bound of
+ * the bucket containing that percentile (see Histogram::getPercentile).
+ *
+ * @param metric The metric to fetch the value of.
+ *
+ * @throw pcp::exception if \a metric, or its instance, is not known, or there
+ *                       are no queues to take percentiles of.
+ *
+ * @return The value of the requested metric.
+ */
+pcp::pmda::fetch_value_result QpidPmdaQmf1::fetchHistogramValue(const metric_id &metric)
+{
+    const bool percentile = (metric.cluster == 10);
+    if (metric.instance >= (percentile ? sizeof(percentiles) / sizeof(percentiles[0])
+                                       : static_cast<size_t>(Histogram::BucketCount))) {
+        __pmNotifyErr(LOG_ERR, "unknown instance %ju for cluster %ju",
+                      (uintmax_t)metric.instance, (uintmax_t)metric.cluster);
+        throw pcp::exception(PM_ERR_INST);
+    }
+    std::map<unsigned int, Histogram>::iterator combined = fetchHistograms.find(metric.item);
+    if (combined == fetchHistograms.end()) {
+        Histogram total;
+        for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator iter = brokerSessions.begin();
+             iter != brokerSessions.end(); ++iter)
+        {
+            Histogram histogram;
+            if (!(*iter)->getListener().getHistogram(ConsoleUtils::Queue, metric.item, histogram)) {
+                __pmNotifyErr(LOG_ERR, "unknown metric %ju for cluster %ju",
+                              (uintmax_t)metric.item, (uintmax_t)metric.cluster);
+                throw pcp::exception(PM_ERR_PMID);
+            }
+            total.add(histogram);
+        }
+        combined = fetchHistograms.insert(std::make_pair(metric.item, total)).first;
+    }
+    const Histogram &total = combined->second;
+    if (!percentile) {
+        return pcp::atom(metric.type, total.getCount(metric.instance));
+    }
+    uint64_t value;
+    if (!total.getPercentile(percentiles[metric.instance], value)) {
+        throw pcp::exception(PM_ERR_VALUE); // No queues yet.
+    }
+    switch (metric.type) {
+        case PM_TYPE_U32:
+            return pcp::atom(metric.type, static_cast<uint32_t>(
+                std::min<uint64_t>(value, std::numeric_limits<uint32_t>::max())));
+        default:
+            return pcp::atom(metric.type, value);
     }
 }
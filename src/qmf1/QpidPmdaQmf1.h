@@ -34,7 +34,13 @@
 #include <qpid/client/ConnectionSettings.h>
 #include <qpid/console/SessionManager.h>
 
-#include "ConsoleListener.h"
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+
+#include "BrokerSession.h"
+#include "Histogram.h"
+#include "StateFile.h"
 
 /**
  * @brief Qpid PMDA using QMF version 1.
@@ -44,6 +50,8 @@ class QpidPmdaQmf1 : public pcp::pmda {
 public:
     QpidPmdaQmf1();
 
+    virtual ~QpidPmdaQmf1();
+
     virtual std::string get_pmda_name() const;
 
     virtual int get_default_pmda_domain_number() const;
@@ -53,15 +61,62 @@ public:
 protected:
     bool nonPmdaMode; ///< Was "non-pmda" mode requested (on the command line).
 
+    string_vector metricIncludes; ///< Globs of metric names to export.
+    string_vector metricExcludes; ///< Globs of metric names not to export.
+
     /// A simple vector of QMF console connections to establish.
     std::vector<qpid::client::ConnectionSettings> qpidConnectionSettings;
 
     pcp::instance_domain broker_domain; ///< The "broker" instance domain.
     pcp::instance_domain queue_domain;  ///< The "queue" instance domain.
     pcp::instance_domain system_domain; ///< The "system" instance domain.
-
-    ConsoleListener consoleListener;              ///< A QMF console listener.
-    qpid::console::SessionManager sessionManager; ///< A QMF session manager.
+    pcp::instance_domain connection_domain; ///< The "connection" instance domain.
+    pcp::instance_domain aggregate_domain;  ///< The "aggregate" instance domain.
+    pcp::instance_domain histogram_domain;  ///< The "histogram" instance domain.
+    pcp::instance_domain percentile_domain; ///< The "percentile" instance domain.
+
+    /// Independent QMF sessions, one per broker, indexed by connection instance ID.
+    std::vector<boost::shared_ptr<BrokerSession> > brokerSessions;
+
+    bool passiveMode;          ///< Query brokers on fetch only?
+    time_t maxStaleness;       ///< Maximum age of QMF data before querying.
+    unsigned int queryTimeout; ///< Timeout for broker queries, in seconds.
+
+    /// Record layouts, indexed by object type, then statistics (or not).
+    ObjectRecord::Layout layouts[ConsoleUtils::Other][2];
+
+    StateFile stateFile;         ///< Persisted last known values, for warm restarts.
+    time_t stateInterval;        ///< Seconds between state file saves, or 0 for never.
+    time_t lastStateSaveTime;    ///< Time the state was last saved.
+    time_t staleGracePeriod;     ///< Seconds to serve stale instances for.
+    time_t staleExpiryTime;      ///< Time to drop any remaining stale instances.
+    std::vector<ObjectEntry::Ptr> staleEntries; ///< Instances loaded from stateFile.
+    size_t staleCount;           ///< Stale instances not yet taken over, nor dropped.
+
+    /// A known PCP instance, and the snapshots it resolved to for this fetch.
+    struct Instance {
+        ObjectEntry::Ptr entry;         ///< The instance's QMF object entry.
+        ObjectEntry::Snapshot props;    ///< Properties snapshot for this fetch.
+        ObjectEntry::Snapshot stats;    ///< Statistics snapshot for this fetch.
+        bool resolved;                  ///< Resolved yet, for this fetch?
+        bool stale;                     ///< Still serving values from stateFile?
+        Instance() : resolved(false), stale(false) { }
+    };
+
+    /// Known instances, indexed by object type, then PCP instance ID.
+    std::vector<Instance> instances[ConsoleUtils::Other];
+
+    /// Instances resolved during the current fetch, as type / instance ID pairs.
+    std::vector<std::pair<unsigned int, unsigned int> > resolvedInstances;
+
+    /// ConsoleListener generation as of the most recent begin_fetch_values.
+    uint64_t fetchGeneration;
+
+    /// Queue histograms summed across all brokers for the current fetch, by item.
+    std::map<unsigned int, Histogram> fetchHistograms;
+
+    /// Instance domain generations, indexed by object type.
+    uint64_t indomGenerations[ConsoleUtils::Other];
 
     virtual boost::program_options::options_description get_supported_options() const;
 
@@ -75,10 +130,61 @@ protected:
 
     virtual pcp::metrics_description get_supported_metrics();
 
+    pcp::metrics_description getAllMetrics();
+
+    bool isMetricSelected(const std::string &name) const;
+
+    qpid::console::SessionManager::Settings getSessionSettings() const;
+
     virtual void begin_fetch_values();
 
     virtual fetch_value_result fetch_value(const metric_id &metric);
 
+    const Instance &resolveInstance(const metric_id &metric);
+
+    fetch_value_result fetchPmdaValue(const metric_id &metric);
+
+    fetch_value_result fetchConnectionValue(const metric_id &metric);
+
+    fetch_value_result fetchAggregateValue(const metric_id &metric);
+
+    fetch_value_result fetchHistogramValue(const metric_id &metric);
+
+    /**
+     * @brief Sum a ConsoleListener counter across all broker sessions.
+     *
+     * @param getter ConsoleListener member function returning the counter.
+     *
+     * @return The sum of the counter across all broker sessions.
+     */
+    template <typename Type>
+    Type sumListeners(Type (ConsoleListener::*getter)() const) const
+    {
+        Type total = 0;
+        for (std::vector<boost::shared_ptr<BrokerSession> >::const_iterator iter = brokerSessions.begin();
+             iter != brokerSessions.end(); ++iter)
+        {
+            total += ((*iter)->getListener().*getter)();
+        }
+        return total;
+    }
+
+    ConsoleUtils::ObjectSchemaType dropInstance(ObjectEntry &entry);
+
+    void dropInstances(const std::vector<ObjectEntry::Ptr> &entries);
+
+    void registerNewInstances();
+
+    size_t registerInstances(const std::vector<ObjectEntry::Ptr> &entries);
+
+    void loadState();
+
+    void saveState();
+
+    pcp::instance_domain * getDomain(const ConsoleUtils::ObjectSchemaType type);
+
+    void markIndomChanged(const ConsoleUtils::ObjectSchemaType type);
+
 };
 
 #endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Defines the StateFile class.
+ */
+
+#include "StateFile.h"
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const char fileMagic[8] = { 'Q', 'P', 'I', 'D', 'P', 'M', 'D', 'A' }; ///< State file magic.
+const uint32_t fileVersion = 2; ///< State file format version.
+
+}
+
+/**
+ * @brief Constructor.
+ *
+ * @param fileName Name of the state file.
+ */
+StateFile::StateFile(const std::string &fileName)
+    : fileName(fileName), havePending(false), stopped(false)
+{
+
+}
+
+/**
+ * @brief Destructor.
+ */
+StateFile::~StateFile()
+{
+    stop();
+}
+
+/**
+ * @brief Get the name of the state file.
+ *
+ * @return The name of the state file.
+ */
+const std::string &StateFile::getFileName() const
+{
+    return fileName;
+}
+
+/**
+ * @brief Set the name of the state file.
+ *
+ * This must be called before start to have any effect on save.
+ *
+ * @param fileName Name of the state file.
+ */
+void StateFile::setFileName(const std::string &fileName)
+{
+    this->fileName = fileName;
+}
+
+/**
+ * @brief Load PCP instances, and their QMF object entries, from the state file.
+ *
+ * Each loaded entry has a default (null) object ID, and properties and
+ * statistics snapshots as last saved. Instances are loaded in the order they
+ * were saved.
+ *
+ * @param instances Vector to append the loaded instances to.
+ *
+ * @return The number of instances appended to \a instances.
+ */
+size_t StateFile::load(std::vector<Instance> &instances) const
+{
+    std::ifstream stream(fileName.c_str(), std::ios::in | std::ios::binary);
+    if (!stream) {
+        __pmNotifyErr(LOG_INFO, "no state file %s to load", fileName.c_str());
+        return 0;
+    }
+
+    char magic[sizeof(fileMagic)];
+    uint32_t version = 0, count = 0;
+    stream.read(magic, sizeof(magic));
+    stream.read(reinterpret_cast<char *>(&version), sizeof(version));
+    stream.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if ((!stream) || (!std::equal(magic, magic + sizeof(magic), fileMagic)) ||
+        (version != fileVersion)) {
+        __pmNotifyErr(LOG_WARNING, "ignoring unrecognised state file %s", fileName.c_str());
+        return 0;
+    }
+
+    const size_t initialSize = instances.size();
+    for (uint32_t index = 0; index < count; ++index) {
+        int32_t instanceId = -1;
+        stream.read(reinterpret_cast<char *>(&instanceId), sizeof(instanceId));
+        const ObjectEntry::Snapshot props(ObjectEntry::createSnapshot(stream));
+        const ObjectEntry::Snapshot stats(ObjectEntry::createSnapshot(stream));
+        if (!stream) {
+            __pmNotifyErr(LOG_WARNING, "state file %s is truncated or corrupt",
+                          fileName.c_str());
+            break;
+        }
+        const ObjectEntry::Ptr entry = ObjectEntry::create(qpid::console::ObjectId());
+        entry->setProps(props);
+        entry->setStats(stats);
+        instances.push_back(std::make_pair(static_cast<int>(instanceId), entry));
+    }
+    __pmNotifyErr(LOG_INFO, "loaded %ju objects from %s",
+                  (uintmax_t)(instances.size() - initialSize), fileName.c_str());
+    return instances.size() - initialSize;
+}
+
+/**
+ * @brief Save PCP instances, and their QMF object entries, to the state file,
+ *        in the background.
+ *
+ * This function returns immediately. Only the most recent instances passed to
+ * this function are written, so if the background thread falls behind, any
+ * intervening saves are skipped.
+ *
+ * The instance IDs are copied here, since they are owned by the PMDA's thread,
+ * whereas the entries' snapshots can safely be read by the background thread.
+ *
+ * @param instances Instances to save.
+ */
+void StateFile::save(const std::vector<Instance> &instances)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pending = instances;
+        havePending = true;
+    }
+    condition.notify_one();
+}
+
+/**
+ * @brief Start the background writer thread.
+ */
+void StateFile::start()
+{
+    if (thread.get_id() == boost::thread::id()) {
+        thread = boost::thread(&StateFile::writeInstances, this);
+    }
+}
+
+/**
+ * @brief Stop the background writer thread.
+ *
+ * Any instances not yet written are discarded.
+ */
+void StateFile::stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        stopped = true;
+    }
+    condition.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Write PCP instances, and their QMF object entries, to the state file.
+ *
+ * Instances whose entries lack either properties or statistics are skipped.
+ *
+ * @param instances Instances to write.
+ */
+void StateFile::write(const std::vector<Instance> &instances) const
+{
+    const std::string tempFileName = fileName + ".tmp";
+    std::ofstream stream(tempFileName.c_str(),
+                         std::ios::out | std::ios::binary | std::ios::trunc);
+
+    // A PCP instance ID, with its properties and statistics snapshots.
+    typedef std::pair<int32_t, std::pair<ObjectEntry::Snapshot, ObjectEntry::Snapshot> > Snapshots;
+    std::vector<Snapshots> snapshots;
+    snapshots.reserve(instances.size());
+    for (std::vector<Instance>::const_iterator iter = instances.begin();
+         iter != instances.end(); ++iter)
+    {
+        const ObjectEntry::Snapshot props = iter->second->getProps();
+        const ObjectEntry::Snapshot stats = iter->second->getStats();
+        if ((props) && (stats)) {
+            snapshots.push_back(std::make_pair(iter->first, std::make_pair(props, stats)));
+        }
+    }
+
+    const uint32_t count = snapshots.size();
+    stream.write(fileMagic, sizeof(fileMagic));
+    stream.write(reinterpret_cast<const char *>(&fileVersion), sizeof(fileVersion));
+    stream.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    for (std::vector<Snapshots>::const_iterator iter = snapshots.begin();
+         iter != snapshots.end(); ++iter)
+    {
+        stream.write(reinterpret_cast<const char *>(&iter->first), sizeof(iter->first));
+        iter->second.first->write(stream);
+        iter->second.second->write(stream);
+    }
+    stream.close();
+
+    if (!stream) {
+        __pmNotifyErr(LOG_ERR, "failed to write state file %s", tempFileName.c_str());
+        std::remove(tempFileName.c_str());
+    } else if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+        __pmNotifyErr(LOG_ERR, "failed to rename %s to %s: %s", tempFileName.c_str(),
+                      fileName.c_str(), strerror(errno));
+        std::remove(tempFileName.c_str());
+    } else if (pmDebug & DBG_TRACE_APPL0) {
+        __pmNotifyErr(LOG_DEBUG, "saved %ju objects to %s", (uintmax_t)count, fileName.c_str());
+    }
+}
+
+/**
+ * @brief Write saved instances, until stopped.
+ *
+ * This is the body of the background writer thread.
+ *
+ * @see save
+ */
+void StateFile::writeInstances()
+{
+    std::vector<Instance> instances;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while ((!havePending) && (!stopped)) {
+                condition.wait(lock);
+            }
+            if (stopped) {
+                return;
+            }
+            instances.swap(pending);
+            pending.clear();
+            havePending = false;
+        }
+        write(instances);
+        instances.clear();
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Declares the StateFile class.
+ */
+
+#ifndef __QPID_PMDA_STATE_FILE_H__
+#define __QPID_PMDA_STATE_FILE_H__
+
+#include "ObjectEntry.h"
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Persists PCP instances, and the last known snapshots of their QMF
+ *        objects, for warm restarts.
+ *
+ * The PMDA periodically hands its current instance IDs and object entries to
+ * save, which returns immediately; the instance IDs and snapshots are then
+ * written (via a temporary file, renamed into place) by this class's own
+ * background thread, so the fetch path never waits on disk I/O.
+ *
+ * On startup, load reads them back, so the PMDA can serve each instance's
+ * snapshots (as stale values) until live QMF data arrives. The instance IDs
+ * themselves are restored by PCP's own cache; the saved IDs are only used to
+ * check that they were.
+ */
+class StateFile {
+
+public:
+    explicit StateFile(const std::string &fileName = std::string());
+
+    ~StateFile();
+
+    const std::string &getFileName() const;
+
+    void setFileName(const std::string &fileName);
+
+    /// A PCP instance ID, and the QMF object entry registered under it.
+    typedef std::pair<int, ObjectEntry::Ptr> Instance;
+
+    size_t load(std::vector<Instance> &instances) const;
+
+    void save(const std::vector<Instance> &instances);
+
+    void start();
+
+    void stop();
+
+protected:
+    std::string fileName; ///< Name of the state file.
+
+    void write(const std::vector<Instance> &instances) const;
+
+    void writeInstances();
+
+private:
+    std::vector<Instance> pending;         ///< Instances waiting to be written.
+    bool havePending;                      ///< Are pending instances waiting?
+    bool stopped;                          ///< Has stop been called?
+    boost::mutex mutex;                    ///< Protects the above.
+    boost::condition_variable condition;   ///< Signalled on save and stop.
+    boost::thread thread;                  ///< Background writer thread.
+
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Defines the UpdateBuffer class.
+ */
+
+#include "UpdateBuffer.h"
+
+/**
+ * @brief Constructor.
+ *
+ * @param capacity Maximum number of objects to hold pending updates for.
+ */
+UpdateBuffer::UpdateBuffer(const size_t capacity)
+    : capacity(capacity), coalesced(0), dropped(0), taken(0), applied(0), stopped(false)
+{
+
+}
+
+/**
+ * @brief Push a QMF object update.
+ *
+ * If an update of the same kind is already pending for the same object, it is
+ * replaced (and counted as coalesced).
+ *
+ * @param object     Updated QMF object.
+ * @param statistics \c true if \a object is a statistics update, \c false if
+ *                   it is a properties update.
+ *
+ * @return \c false if the update was dropped, otherwise \c true.
+ */
+bool UpdateBuffer::push(const qpid::console::Object &object, const bool statistics)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    const UpdateMap::const_iterator iter = index.find(object.getObjectId());
+    size_t position = pending.size();
+    if (iter != index.end()) {
+        position = iter->second;
+    } else if ((statistics) && (pending.size() >= capacity)) {
+        ++dropped;
+        return false;
+    } else {
+        index.insert(std::make_pair(object.getObjectId(), position));
+        pending.push_back(Update());
+    }
+    Update &update = pending[position];
+    boost::optional<qpid::console::Object> &slot = (statistics) ? update.stats : update.props;
+    if (slot) {
+        ++coalesced;
+    }
+    slot = object;
+    lock.unlock();
+    condition.notify_one();
+    return true;
+}
+
+/**
+ * @brief Take all pending updates.
+ *
+ * This function blocks until at least one update is pending, or stop is called.
+ *
+ * Calling this function again marks the previously taken batch as applied (see
+ * flush), so the consumer thread should only call it once it has finished with
+ * the previous batch.
+ *
+ * @param updates Vector to receive the pending updates, in arrival order. Any
+ *                existing contents are discarded.
+ *
+ * @return \c false if stop has been called, otherwise \c true.
+ */
+bool UpdateBuffer::take(std::vector<Update> &updates)
+{
+    updates.clear();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (applied != taken) {
+        applied = taken;
+        appliedCondition.notify_all();
+    }
+    while ((pending.empty()) && (!stopped)) {
+        condition.wait(lock);
+    }
+    if (stopped) {
+        return false;
+    }
+    updates.swap(pending);
+    index.clear();
+    ++taken;
+    return true;
+}
+
+/**
+ * @brief Wait for all updates pushed so far to be applied.
+ *
+ * That is, wait until the consumer thread has finished with the batch it is
+ * currently applying (if any), and with the batch containing any updates still
+ * pending. Updates pushed by other threads meanwhile may be applied too, but
+ * this function does not wait for any batches beyond those.
+ *
+ * This function returns early if stop is called.
+ */
+void UpdateBuffer::flush()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    const uint64_t target = (pending.empty()) ? taken : taken + 1;
+    while ((applied < target) && (!stopped)) {
+        appliedCondition.wait(lock);
+    }
+}
+
+/**
+ * @brief Stop this buffer, waking any blocked take and flush calls.
+ */
+void UpdateBuffer::stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        stopped = true;
+    }
+    condition.notify_all();
+    appliedCondition.notify_all();
+}
+
+/**
+ * @brief Get the number of updates superseded by later updates so far.
+ *
+ * @return The number of coalesced updates.
+ */
+uint64_t UpdateBuffer::getCoalescedCount() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return coalesced;
+}
+
+/**
+ * @brief Get the number of updates dropped, because this buffer was full.
+ *
+ * @return The number of dropped updates.
+ */
+uint64_t UpdateBuffer::getDroppedCount() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return dropped;
+}
+
+/**
+ * @brief Get the number of objects with updates currently pending.
+ *
+ * @return The number of objects with pending updates.
+ */
+size_t UpdateBuffer::getPendingCount() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return pending.size();
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2013-2014 Paul Colby
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file
+ * @brief Declares the UpdateBuffer class.
+ */
+
+#ifndef __QPID_PMDA_UPDATE_BUFFER_H__
+#define __QPID_PMDA_UPDATE_BUFFER_H__
+
+#include <qpid/console/Object.h>
+
+#include <boost/optional/optional.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "ConsoleUtils.h"
+
+/**
+ * @brief Bounded, coalescing buffer of pending QMF object updates.
+ *
+ * This class sits between the QMF client's callback thread, which pushes
+ * updates as they arrive, and a consumer thread that takes them in batches.
+ *
+ * Updates are keyed by QMF object ID, with the latest value winning, so bursts
+ * of updates for the same object are coalesced before any work is done on the
+ * superseded ones. The number of objects with pending updates is bounded; once
+ * full, statistics updates for further objects are dropped. Properties updates
+ * are never dropped, since the broker does not normally re-send them, and they
+ * are needed to ever report the object at all.
+ *
+ * Producers may also wait, via flush, for all of the updates they have pushed
+ * to be applied by the consumer thread.
+ */
+class UpdateBuffer {
+
+public:
+    /// The latest pending updates for a single QMF object.
+    struct Update {
+        boost::optional<qpid::console::Object> props; ///< Pending properties.
+        boost::optional<qpid::console::Object> stats; ///< Pending statistics.
+    };
+
+    explicit UpdateBuffer(const size_t capacity = 65536);
+
+    bool push(const qpid::console::Object &object, const bool statistics);
+
+    bool take(std::vector<Update> &updates);
+
+    void flush();
+
+    void stop();
+
+    uint64_t getCoalescedCount() const;
+
+    uint64_t getDroppedCount() const;
+
+    size_t getPendingCount() const;
+
+protected:
+    /// A simple map of QMF object IDs to indexes into the pending vector.
+    typedef boost::unordered_map<qpid::console::ObjectId, size_t, ConsoleUtils::ObjectIdHash> UpdateMap;
+
+    const size_t capacity;        ///< Maximum number of objects pending.
+    std::vector<Update> pending;  ///< Pending updates, in arrival order.
+    UpdateMap index;              ///< Indexes into pending, by object ID.
+    uint64_t coalesced;           ///< Number of updates superseded so far.
+    uint64_t dropped;             ///< Number of updates dropped so far.
+    uint64_t taken;               ///< Number of batches taken so far.
+    uint64_t applied;             ///< Number of batches applied so far.
+    bool stopped;                 ///< Has stop been called?
+
+    mutable boost::mutex mutex;   ///< Protects all of the above.
+    boost::condition_variable condition; ///< Signalled on push and stop.
+    boost::condition_variable appliedCondition; ///< Signalled on apply and stop.
+
+};
+
+#endif